@@ -10,21 +10,40 @@
 
 #include "dispatcher.h"
 #include "timer.h"
+#include "interrupts.h"
 #include <map>
 #include <iostream>
 #include <algorithm>
 #include <utility>
 
-#define STUBS
-#ifdef STUBS
-// TODO: Remove!!!!!!!!!!!!!!!!!!!!!!!!
-#define interrupts_on()
-#define interrupts_off()
-#endif /* STUBS */
-
+#ifdef TIMER_FREE_RUNNING
 /** Maximum value for the ms hal timer.
+ **
+ ** The free running RTC has a single tick rate for all ranges: the
+ ** ms range covers the whole uint16_t argument.
  **/
 #define HAL_TIMER_MAX_RANGE_MS UINT16_MAX
+#else
+/** Maximum value for the ms hal timer.
+ **
+ ** Bound by the RTC prescaler used for the ms range
+ ** (see TIMER_MS_FREQ_DIV in timer_config.h).
+ **/
+#define HAL_TIMER_MAX_RANGE_MS 1999
+#endif
+
+/** Maximum value for the seconds hal timer.
+ **/
+#define HAL_TIMER_MAX_RANGE_SEC 63
+
+/** Maximum value for the minutes hal timer.
+ **/
+#define HAL_TIMER_MAX_RANGE_MIN 546
+
+/** Milliseconds in one second and one minute.
+ **/
+#define MS_PER_SEC             1000
+#define MS_PER_MIN             60000
 
 /** Minimum value used to reload the HAL timer.
  **/
@@ -49,7 +68,12 @@ Dispatcher *Dispatcher::instance = nullptr;
  **/
 void on_hal_timer_callback(void)
 {
-    /* If this function is called, instance is initialised. */
+    /* If this function is called, instance is initialised.
+     * HAL timer is only used in one-shot mode: it is not running
+     * anymore. Make sure it gets reloaded even if the head didn't
+     * change (i.e. we were hopping towards a far deadline).
+     */
+    Dispatcher::instance->timerActive = false;
     Dispatcher::instance->processTimetable();
 }
 
@@ -57,7 +81,7 @@ void on_hal_timer_callback(void)
  **/
 void Dispatcher::refreshTimestamp(void)
 {
-    timestamp = timer_get_tick();
+    timestamp = timer_get_ms();
 }
 
 /** Goes through the backlog of expired iTasks and calls
@@ -153,36 +177,67 @@ void Dispatcher::updateHeadAndTimer(void)
         auto timer_value = head->first > timestamp + HAL_TIMER_MIN_RELOAD_MS ?
                 head->first - timestamp : (dispatchTimestamp)HAL_TIMER_MIN_RELOAD_MS;
 
-        /* Ensure also that we don't exceed the max range. If we do, we'd need to
-         * progressively hop towards the deadline.
-         */
-        timer_value = std::min(timer_value, (dispatchTimestamp)HAL_TIMER_MAX_RANGE_MS);
-        timer_start_one_shot_ms(timer_value, on_hal_timer_callback);
+        startHalTimer(timer_value);
         headTimestamp = head->first;
     }
 }
 
+/** Program the HAL timer to expire "ms" milliseconds from now, or
+ ** as close as possible to it without overshooting.
+ **
+ ** With a free running RTC the ms range covers about a minute: far
+ ** deadlines are approached in steps of HAL_TIMER_MAX_RANGE_MS,
+ ** processTimetable() reloading the timer with the remainder.
+ **
+ ** Otherwise the ms range of the HAL timer only covers a couple of
+ ** seconds. Far deadlines are approached using the coarser (seconds,
+ ** minutes) ranges first: each expiry lands on a whole number of
+ ** seconds or minutes before the deadline and processTimetable()
+ ** reloads the timer with the remainder, using the finer range only
+ ** close to the deadline. This keeps the number of wake-ups to a
+ ** handful while preserving ms accuracy.
+ **/
+void Dispatcher::startHalTimer(dispatchTimestamp ms)
+{
+#ifdef TIMER_FREE_RUNNING
+    auto step = std::min(ms, (dispatchTimestamp)HAL_TIMER_MAX_RANGE_MS);
+    timer_start_one_shot_ms(step, on_hal_timer_callback);
+#else
+    if(ms <= HAL_TIMER_MAX_RANGE_MS)
+    {
+        timer_start_one_shot_ms(ms, on_hal_timer_callback);
+    }
+    else if((ms / MS_PER_SEC) <= HAL_TIMER_MAX_RANGE_SEC)
+    {
+        timer_start_one_shot_sec(ms / MS_PER_SEC, on_hal_timer_callback);
+    }
+    else
+    {
+        auto min = std::min(ms / MS_PER_MIN, (dispatchTimestamp)HAL_TIMER_MAX_RANGE_MIN);
+        timer_start_one_shot_min(min, on_hal_timer_callback);
+    }
+#endif
+}
+
 /** Helper function to add iTasks to the timetable.
  **/
 void Dispatcher::addTask(iTaskPtr task, dispatchTimestamp ms, bool periodic)
 {
     refreshTimestamp();
     auto period = periodic ? ms : NO_PERIOD;
-    interrupts_off();
+    InterruptsGuard guard;
     auto deadline = timestamp + ms;
     timetable[deadline] = {task , period};
     updateHeadAndTimer();
-    interrupts_on();
 }
 
 Dispatcher& Dispatcher::get(void)
 {
-    interrupts_off();
+    InterruptsGuard guard;
     if(instance == nullptr)
     {
         instance = new Dispatcher();
     }
-    interrupts_on();
     return *instance;
 }
 
@@ -199,8 +254,8 @@ void Dispatcher::addTaskOneShot(iTaskPtr task, dispatchTimestamp ms)
 bool Dispatcher::removeTask(iTaskPtr task)
 {
     bool res = false;
+    InterruptsGuard guard;
 
-    interrupts_off();
     for(auto it = timetable.begin(); it != timetable.end(); it++)
     {
         if(it->second.task.lock() == task.lock())
@@ -211,7 +266,6 @@ bool Dispatcher::removeTask(iTaskPtr task)
             break;
         }
     }
-    interrupts_on();
     return res;
 }
 /****************************************************************/
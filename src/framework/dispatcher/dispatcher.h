@@ -130,6 +130,7 @@ private:
     void addTask(iTaskPtr task, dispatchTimestamp ms, bool periodic);
     void refreshTimestamp(void);
     void updateHeadAndTimer(void);
+    void startHalTimer(dispatchTimestamp ms);
     void processTimetable(void);
     /** Unit test class to access private properties from separate
      ** unit test file.
@@ -76,7 +76,7 @@ void DispatcherUnitTest::destroyDispatcher(void)
 **/
 void DispatcherUnitTest::printTimetable(void)
 {
-    std::cout << "   Timetable @time=" << timer_get_tick() << ":" << std::endl;
+    std::cout << "   Timetable @time=" << timer_get_ms() << ":" << std::endl;
     if(dispatcher.timetable.empty())
     {
         std::cout << "Empty" << std::endl;
@@ -400,6 +400,54 @@ void testDanglingTaskPeriodic(void)
     std::cout << std::endl;
 }
 
+/*!    \brief Verify far deadlines are reached with few HAL timer wake-ups.
+**
+** A 10 minutes (and some ms) one-shot must run exactly at its deadline,
+** hopping through the ms range of the free running HAL timer (about a
+** minute per hop), or else through its minutes, seconds and ms ranges.
+**/
+void testLongOneShot(void)
+{
+    std::cout << "  <<testLongOneShot>>" << std::endl;
+    timer_init();
+    timer_host_reset_time();
+
+    unsigned int runCount = 0;
+    auto &dispatcher { Dispatcher::get() };
+    auto testTask1 { std::make_shared<TestTask>(1, runCount) };
+    DispatcherUnitTest dispUT {dispatcher};
+
+    std::vector< std::shared_ptr<iTask> > expectedTasks{testTask1};
+    std::vector< std::shared_ptr<iTask> > empty{};
+    std::cout <<"Adding testTask1 (one-shot) @ time=612345" <<std::endl;
+    dispatcher.addTaskOneShot(testTask1, 612345);
+    std::cout <<" Wait 612344 ms" <<std::endl;
+    timer_host_elapse_time(612344);
+    dispUT.verifyTimetable(expectedTasks);
+    verifyRunCount(runCount, 0);
+    dispUT.verifyTimerState(true);
+    std::cout <<" Wait 1 ms" <<std::endl;
+    timer_host_elapse_time(1);
+    verifyRunCount(runCount, 1);
+    dispUT.verifyTimerState(false);
+    dispUT.verifyTimetable(empty);
+#ifdef TIMER_FREE_RUNNING
+    const uint32_t expectedExpiries = (612345 + UINT16_MAX - 1) / UINT16_MAX;
+#else
+    const uint32_t expectedExpiries = 3;
+#endif
+    std::cout << " Check HAL timer expired " << expectedExpiries << " times.";
+    std::cout << " Actual expiries: " << timer_host_get_expiries();
+    if(timer_host_get_expiries() != expectedExpiries)
+    {
+        throw std::runtime_error("FAIL: unexpected number of HAL timer expiries!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    dispUT.destroyDispatcher();
+    std::cout << std::endl;
+    std::cout << std::endl;
+}
+
 int main(void)
 {
     testSimpleOneShot();
@@ -408,5 +456,6 @@ int main(void)
     testSingleton();
     testDanglingTaskOneShot();
     testDanglingTaskPeriodic();
+    testLongOneShot();
 }
 /****************************************************************/
@@ -7,6 +7,7 @@
 /****************************************************************/
 
 #include "event.h"
+#include "interrupts.h"
 
 Event::Event(eventId id)
 {
@@ -20,17 +21,88 @@ eventId Event::getId(void)
 
 void EventQueue::pushEvent(baseEventPtr &&e)
 {
+    InterruptsGuard guard;
     eventQ.push(std::move(e));
 }
 
+void EventQueue::attachSource(IsrEventSource &s)
+{
+    InterruptsGuard guard;
+    auto p = &sources;
+
+    /* Append: sources are polled in attach order. */
+    while(*p != nullptr)
+    {
+        p = &(*p)->next;
+    }
+    s.next = nullptr;
+    *p = &s;
+}
+
+void EventQueue::detachSource(IsrEventSource &s)
+{
+    InterruptsGuard guard;
+    for(auto p = &sources; *p != nullptr; p = &(*p)->next)
+    {
+        if(*p == &s)
+        {
+            *p = s.next;
+            s.next = nullptr;
+            break;
+        }
+    }
+}
+
+bool EventQueue::isIdle(void)
+{
+    InterruptsGuard guard;
+    if(!eventQ.empty())
+    {
+        return false;
+    }
+    for(auto s = sources; s != nullptr; s = s->next)
+    {
+        if(s->raised)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 void EventQueue::processQ(void)
 {
-    while(!eventQ.empty())
+    /* Turn what interrupts recorded into events first: they are
+     * handled in the same pass.
+     */
+    for(auto s = sources; s != nullptr; s = s->next)
+    {
+        bool raised;
+        {
+            InterruptsGuard guard;
+            raised = s->raised;
+            s->raised = false;
+        }
+        if(raised)
+        {
+            s->postPending(*this);
+        }
+    }
+    for(;;)
     {
+        baseEventPtr e;
+        {
+            /* Only the queue access is protected */
+            InterruptsGuard guard;
+            if(eventQ.empty())
+            {
+                break;
+            }
+            e = std::move(eventQ.front());
+            eventQ.pop();
+        }
         /* Call virtual method on each queued event */
-        auto e = std::move(eventQ.front());
         handleEvent(std::move(e));
-        eventQ.pop();
     }
 }
 
@@ -102,6 +102,50 @@ using baseEventPtr = std::unique_ptr<Event>;
 template<typename T>
 using eventPtr = std::unique_ptr<T>;
 
+class EventQueue;
+
+/*!    \brief Base class for sources of events raised in interrupt context.
+**
+** Creating an event allocates it on the heap, which is not reentrant:
+** interrupt handlers shall not call sendEvent. Instead, a source is
+** attached to an EventQueue (see EventQueue::attachSource), its handler
+** records what happened in members of the concrete source and calls
+** "raise". At the next processQ, the queue calls "postPending" on the
+** raised sources, from the main context, to create the events.
+**
+** Nothing is allocated: the source links itself into the queue.
+**/
+class IsrEventSource
+{
+public:
+    IsrEventSource() = default;
+    IsrEventSource(const IsrEventSource &) = delete;
+    IsrEventSource& operator=(const IsrEventSource &) = delete;
+    virtual ~IsrEventSource() = default;
+
+protected:
+    /*!    \brief Ask the queue to call postPending.
+    **
+    ** Safe to call from interrupt context.
+    **/
+    void raise(void) { raised = true; };
+
+    /*!    \brief Post the events recorded since the last call.
+    **
+    ** \param [in] q - queue the source is attached to.
+    **
+    ** Called by EventQueue::processQ with interrupts enabled. Concrete
+    ** sources read (and clear) their records with interrupts disabled,
+    ** then use sendEvent.
+    **/
+    virtual void postPending(EventQueue &q) = 0;
+
+private:
+    friend class EventQueue;
+    IsrEventSource *next = nullptr;
+    volatile bool raised = false;
+};
+
 /*!    \brief Base class for event queues.
 **
 ** Event queues are the receivers of system "events". Modules intended to
@@ -113,8 +157,10 @@ using eventPtr = std::unique_ptr<T>;
 ** of EventQueues can match on the unique eventId and down-cast using the
 ** "reconstructEvent" helper function.
 **
-** Note: EventQueue base API is not thread safe. Users shall provide thread
-** safety, in the cases it is needed.
+** Note: pushEvent and processQ protect the queue with critical sections,
+** but creating an event (sendEvent) allocates from the heap, which is not
+** reentrant: interrupt handlers shall go through an IsrEventSource
+** instead. handleEvent runs with interrupts enabled.
 **/
 class EventQueue
 {
@@ -148,6 +194,40 @@ public:
     **/
     void processQ(void);
 
+    /*!    \brief Attach a source of events raised in interrupt context.
+    **
+    ** \param [in] s - source, not attached to any other queue. It shall
+    **                 be detached before being destroyed.
+    **/
+    void attachSource(IsrEventSource &s);
+
+    /*!    \brief Detach a source attached with attachSource.
+    **
+    ** \param [in] s - source. Nothing happens if it is not attached.
+    **/
+    void detachSource(IsrEventSource &s);
+
+    /*!    \brief Check there is nothing to process.
+    **
+    ** \return true if no event is queued and no source is raised.
+    **
+    ** Call with interrupts disabled before sleeping, so that an event
+    ** raised between processQ and the sleep instruction is not left
+    ** waiting for another interrupt, i.e.:
+    **
+    ** for(;;)
+    ** {
+    **     queue.processQ();
+    **     interrupts_off();
+    **     if(queue.isIdle())
+    **     {
+    **         sleep_auto(); // Enables interrupts atomically.
+    **     }
+    **     interrupts_on();
+    ** }
+    **/
+    bool isIdle(void);
+
     /*!    \brief Handle a specific event.
     **
     ** \param [in] e - event to be handled.
@@ -161,6 +241,7 @@ public:
     virtual void handleEvent(baseEventPtr &&e) = 0;
 private:
     std::queue<baseEventPtr> eventQ;
+    IsrEventSource *sources = nullptr;
 };
 
 /*!    \brief Bad event reconstruction.
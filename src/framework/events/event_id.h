@@ -26,6 +26,7 @@ enum class eventId
 {
     template_1, /* Template event for test 1. */
     template_2, /* Template event for test 2. */
+    serial_rx,  /* Data or frame received on a serial port (SerialRxEvent). */
 };
 #endif /* __EVENT_ID_H */
 /****************************************************************/
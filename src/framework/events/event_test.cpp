@@ -8,6 +8,7 @@
 
 
 #include "event.h"
+#include "interrupts_host_stubs.h"
 
 #include<iostream>
 #include <string>
@@ -242,8 +243,133 @@ void testInvalidReconstruction(void)
     }
 
 }
+
+/*!    \brief EventQueue recording the interrupt state while handling events.
+**/
+class QueueInterruptsCheck : public EventQueue
+{
+public:
+    void handleEvent(baseEventPtr &&e)
+    {
+        (void)e;
+        enabledInHandler = interrupts_host_are_enabled();
+    }
+    bool enabledInHandler = false;
+};
+
+/*!    \brief Critical sections testing.
+**
+** Send an event from main context while already in a critical section
+** and check that the queue critical sections nest correctly and that
+** events are handled with interrupts enabled. Interrupt handlers don't
+** send events: see testIsrEventSource.
+**/
+void testCriticalSections(void)
+{
+    QueueInterruptsCheck q;
+    std::cout << "  <<testCriticalSections>>" << std::endl;
+    std::cout << "Send TemplateEvent1 {1} from a nested critical section (main context)." << std::endl;
+    {
+        InterruptsGuard guard;
+        sendEvent<TemplateEvent1>(q, 1);
+        std::cout << " Check interrupts are still disabled after sending.";
+        if(interrupts_host_are_enabled())
+        {
+            throw std::runtime_error("FAIL: nested critical section enabled interrupts!!");
+        }
+        std::cout << " - OK!" << std::endl;
+    }
+    std::cout << " Check interrupts are enabled when leaving the critical section.";
+    if(!interrupts_host_are_enabled())
+    {
+        throw std::runtime_error("FAIL: interrupts not restored!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    q.processQ();
+    std::cout << " Check the event was handled with interrupts enabled.";
+    if(!q.enabledInHandler || !interrupts_host_are_enabled())
+    {
+        throw std::runtime_error("FAIL: event handled with interrupts disabled!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    std::cout << std::endl;
+}
+
+/*!    \brief IsrEventSource recording how many events to post.
+**/
+class TestIsrSource : public IsrEventSource
+{
+public:
+    /*!    \brief What an interrupt handler does. */
+    void isr(void)
+    {
+        pending++;
+        raise();
+    }
+    uint32_t posted = 0;
+private:
+    void postPending(EventQueue &q)
+    {
+        uint32_t n;
+        {
+            InterruptsGuard guard;
+            n = pending;
+            pending = 0;
+        }
+        for(; n > 0; n--)
+        {
+            sendEvent<TemplateEvent1>(q, n);
+            posted++;
+        }
+    }
+    volatile uint32_t pending = 0;
+};
+
+/*!    \brief IsrEventSource testing.
+**
+** The interrupt path only raises the source: no event is created and no
+** critical section is entered until processQ runs in main context.
+**/
+void testIsrEventSource(void)
+{
+    QueueInterruptsCheck q;
+    TestIsrSource src;
+    std::cout << "  <<testIsrEventSource>>" << std::endl;
+    q.attachSource(src);
+    std::cout << "Raise the source twice from a (simulated) ISR." << std::endl;
+    {
+        InterruptsGuard guard;
+        auto sections = interrupts_host_get_sections();
+        src.isr();
+        src.isr();
+        std::cout << " Check the ISR path entered no critical section.";
+        if(interrupts_host_get_sections() != sections)
+        {
+            throw std::runtime_error("FAIL: raise entered a critical section!!");
+        }
+        std::cout << " - OK!" << std::endl;
+    }
+    std::cout << " Check nothing is posted before processQ, queue is not idle.";
+    if((src.posted != 0) || q.isIdle())
+    {
+        throw std::runtime_error("FAIL: raised source not seen or posted too early!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    q.processQ();
+    std::cout << " Check events were posted and handled in main context.";
+    if((src.posted != 2) || !q.enabledInHandler || !q.isIdle())
+    {
+        throw std::runtime_error("FAIL: raised source not processed!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    q.detachSource(src);
+    std::cout << std::endl;
+}
+
 int main(void)
 {
     testValidSendReceive();
     testInvalidReconstruction();
+    testCriticalSections();
+    testIsrEventSource();
 }
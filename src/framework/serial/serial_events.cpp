@@ -0,0 +1,71 @@
+/*!\file serial_events.cpp
+** \author
+** \copyright
+** \brief Implementation of the serial receive events bridge.
+** \details
+**/
+/****************************************************************/
+
+#include "serial_events.h"
+#include "interrupts.h"
+/****************************************************************/
+
+/** Pending flags: bytes arrived, frame complete. */
+#define SERIAL_PENDING_DATA  0x01
+#define SERIAL_PENDING_FRAME 0x02
+
+SerialEventSource::~SerialEventSource()
+{
+    unsubscribe();
+}
+
+/* Notifications are edges: one that is still pending (i.e. received
+ * before subscribing) is posted to the new queue rather than lost.
+ */
+void SerialEventSource::subscribe(EventQueue &q)
+{
+    unsubscribe();
+    queue = &q;
+    q.attachSource(*this);
+    if(pending != 0)
+    {
+        raise();
+    }
+}
+
+void SerialEventSource::unsubscribe(void)
+{
+    if(queue != nullptr)
+    {
+        queue->detachSource(*this);
+        queue = nullptr;
+    }
+}
+
+/* Interrupt context: no allocation, only flag the source. */
+void SerialEventSource::notify(void *context, bool frame)
+{
+    auto source = static_cast<SerialEventSource *>(context);
+
+    source->pending |= frame ? SERIAL_PENDING_FRAME : SERIAL_PENDING_DATA;
+    source->raise();
+}
+
+void SerialEventSource::postPending(EventQueue &q)
+{
+    uint8_t flags;
+    {
+        InterruptsGuard guard;
+        flags = pending;
+        pending = 0;
+    }
+    if(flags & SERIAL_PENDING_DATA)
+    {
+        sendEvent<SerialRxEvent>(q, port, false);
+    }
+    if(flags & SERIAL_PENDING_FRAME)
+    {
+        sendEvent<SerialRxEvent>(q, port, true);
+    }
+}
+/****************************************************************/
@@ -0,0 +1,126 @@
+/*!\file serial_events.h
+** \author
+** \copyright TODO
+** \brief Bridge from the serial ports receive path to the event system.
+** \details The UART driver calls a notification from its receive interrupt
+**          (see UartClass::onReceive in the core library). A SerialEventSource
+**          records these notifications without allocating and turns them into
+**          SerialRxEvents when the subscribed EventQueue is processed, so the
+**          main loop can sleep until something arrives instead of polling
+**          each port (serialEventRun). I.e.:
+**
+**          SerialEventSource serialSource(0);
+**          serialSource.subscribe(myQueue);
+**          Serial.onReceive(SerialEventSource::notify, &serialSource);
+**          for(;;)
+**          {
+**              myQueue.processQ();
+**              interrupts_off();
+**              if(myQueue.isIdle())
+**              {
+**                  sleep_auto();
+**              }
+**              interrupts_on();
+**          }
+**
+**          Checking the queue with interrupts off closes the window where
+**          a byte arriving after processQ would be left waiting for
+**          another interrupt (see EventQueue::isIdle).
+**
+**          The driver notifies on edges only (first byte in an empty buffer,
+**          frame complete): the handler shall read the port until it is
+**          empty (or all the frames are released).
+**
+**          Frames closed by an idle gap (UartBuffered::setFrameMode) are
+**          timed with a virtual channel of the HAL timer, which also wakes
+**          the loop above up. If the target doesn't link the HAL timer (or
+**          no channel is left), only the first byte of the frame is
+**          notified and the gap is seen by readFrame: use delimiter framing
+**          with this loop then.
+**/
+/****************************************************************/
+#ifndef __SERIAL_EVENTS_H
+#define __SERIAL_EVENTS_H
+
+#include "event.h"
+#include <cstdint>
+/****************************************************************/
+
+/*!    \brief Data received on a serial port.
+**
+** Posted by SerialEventSource (eventId::serial_rx).
+**/
+class SerialRxEvent : public Event
+{
+public:
+    /*!    \brief Constructor.
+    **
+    ** \param [in] port - index of the serial port (0 for Serial, 1 for Serial1...).
+    ** \param [in] frame - true if a frame is complete (frame mode), false if
+    **                     bytes arrived.
+    **/
+    SerialRxEvent(uint8_t port, bool frame) : Event(eventId::serial_rx), port {port}, frame {frame} {};
+
+    /*!    \brief Get the index of the serial port.
+    **/
+    uint8_t getPort(void) { return port; };
+
+    /*!    \brief Check if the event reports a complete frame.
+    **/
+    bool isFrame(void) { return frame; };
+private:
+    uint8_t port;
+    bool frame;
+};
+
+/*!    \brief Source of SerialRxEvents for a serial port.
+**
+** Registered with the UART driver as receive notification. The
+** notification only sets pending flags: the events are created by
+** EventQueue::processQ (see IsrEventSource). Several notifications
+** between two processQ calls give a single event of each kind.
+** The source shall outlive the registration with the driver.
+**/
+class SerialEventSource : public IsrEventSource
+{
+public:
+    /*!    \brief Constructor.
+    **
+    ** \param [in] port - index of the serial port, reported in the events.
+    **/
+    SerialEventSource(uint8_t port) : port {port}, queue {nullptr}, pending {0} {};
+    ~SerialEventSource();
+
+    /*!    \brief Post the events of this port to an EventQueue.
+    **
+    ** \param [in] q - destination queue. Replaces the previous one.
+    **
+    ** Notifications not turned into events yet go to the new queue.
+    **/
+    void subscribe(EventQueue &q);
+
+    /*!    \brief Stop posting events.
+    **/
+    void unsubscribe(void);
+
+    /*!    \brief Receive notification.
+    **
+    ** \param [in] context - the SerialEventSource (registration context).
+    ** \param [in] frame - true if a frame is complete.
+    **
+    ** Signature matches the UART driver notification (UartRxNotify).
+    ** Called from the receive interrupt.
+    **/
+    static void notify(void *context, bool frame);
+
+protected:
+    void postPending(EventQueue &q) override;
+
+private:
+    uint8_t port;
+    EventQueue *queue;
+    volatile uint8_t pending;
+};
+
+#endif /* __SERIAL_EVENTS_H */
+/****************************************************************/
@@ -0,0 +1,196 @@
+/*!\file serial_events_test.cpp
+** \author
+** \copyright
+** \brief Unit test for serial_events.cpp, serial_events.h
+** \details The UART driver is simulated by calling the notification
+**          as the receive interrupt would.
+**/
+/****************************************************************/
+
+#include "serial_events.h"
+#include "interrupts_host_stubs.h"
+
+#include<iostream>
+#include<vector>
+#include<utility>
+#include<stdexcept>
+#include<cstdlib>
+#include<new>
+/****************************************************************/
+
+/** Heap allocations so far: the notification shall not allocate. */
+static size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *p = std::malloc(size);
+    if(p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+/*!    \brief Received notification, as seen by the queue.
+**/
+struct Received
+{
+    uint8_t port;
+    bool frame;
+};
+
+/*!    \brief EventQueue recording the SerialRxEvents it handles.
+**/
+class SerialQueue : public EventQueue
+{
+public:
+    void handleEvent(baseEventPtr &&e) override;
+    std::vector<Received> received;
+};
+
+void SerialQueue::handleEvent(baseEventPtr &&e)
+{
+    if(e->getId() != eventId::serial_rx)
+    {
+        throw std::runtime_error("FAIL: Unexpected event!");
+    }
+    auto ev = reconstructEvent<SerialRxEvent>(std::move(e));
+    received.push_back({ev->getPort(), ev->isFrame()});
+}
+
+/*!    \brief Check the events handled by the queue and clear them.
+**/
+void verifyReceived(SerialQueue &q, const std::vector<Received> &expected)
+{
+    std::cout << "  Received " << q.received.size() << " events, expected " << expected.size();
+    if(q.received.size() != expected.size())
+    {
+        std::cout << " - FAIL!!!" << std::endl;
+        throw std::runtime_error("FAIL: Wrong number of events!");
+    }
+    for(size_t i = 0; i < expected.size(); i++)
+    {
+        if((q.received[i].port != expected[i].port) || (q.received[i].frame != expected[i].frame))
+        {
+            std::cout << " - FAIL!!!" << std::endl;
+            throw std::runtime_error("FAIL: Wrong event data!");
+        }
+    }
+    std::cout << " - OK!" << std::endl;
+    q.received.clear();
+}
+
+/*!    \brief Notifications are posted to the subscribed queue, grouped
+**         by source in subscription order, data before frames.
+**/
+void testNotify(void)
+{
+    std::cout << "  <<testNotify>>" << std::endl;
+    SerialQueue q;
+    SerialEventSource serial0(0);
+    SerialEventSource serial2(2);
+
+    serial0.subscribe(q);
+    serial2.subscribe(q);
+    SerialEventSource::notify(&serial0, false);
+    SerialEventSource::notify(&serial2, true);
+    SerialEventSource::notify(&serial0, true);
+    q.processQ();
+    verifyReceived(q, {{0, false}, {0, true}, {2, true}});
+}
+
+/*!    \brief The notification runs in interrupt context: it shall not
+**         allocate. Repeated notifications give a single event.
+**/
+void testNoAllocation(void)
+{
+    std::cout << "  <<testNoAllocation>>" << std::endl;
+    SerialQueue q;
+    SerialEventSource serial0(0);
+
+    serial0.subscribe(q);
+    std::cout << "  Check the queue is idle.";
+    if(!q.isIdle())
+    {
+        throw std::runtime_error("FAIL: Queue not idle!");
+    }
+    std::cout << " - OK!" << std::endl;
+
+    size_t before = allocations;
+    SerialEventSource::notify(&serial0, false);
+    SerialEventSource::notify(&serial0, false);
+    std::cout << "  Check notifications didn't allocate.";
+    if(allocations != before)
+    {
+        throw std::runtime_error("FAIL: Allocation from the notification!");
+    }
+    std::cout << " - OK!" << std::endl;
+    std::cout << "  Check the queue is no longer idle.";
+    if(q.isIdle())
+    {
+        throw std::runtime_error("FAIL: Raised source not seen!");
+    }
+    std::cout << " - OK!" << std::endl;
+    q.processQ();
+    verifyReceived(q, {{0, false}});
+}
+
+/*!    \brief No event without a subscribed queue.
+**/
+void testUnsubscribe(void)
+{
+    std::cout << "  <<testUnsubscribe>>" << std::endl;
+    SerialQueue q;
+    SerialEventSource serial1(1);
+
+    SerialEventSource::notify(&serial1, false);
+    serial1.subscribe(q);
+    serial1.unsubscribe();
+    SerialEventSource::notify(&serial1, false);
+    q.processQ();
+    verifyReceived(q, {});
+}
+
+/*!    \brief subscribe replaces the destination queue, pending
+**         notifications follow.
+**/
+void testResubscribe(void)
+{
+    std::cout << "  <<testResubscribe>>" << std::endl;
+    SerialQueue q1;
+    SerialQueue q2;
+    SerialEventSource serial3(3);
+
+    serial3.subscribe(q1);
+    SerialEventSource::notify(&serial3, false);
+    serial3.subscribe(q2);
+    SerialEventSource::notify(&serial3, true);
+    q1.processQ();
+    q2.processQ();
+    verifyReceived(q1, {});
+    verifyReceived(q2, {{3, false}, {3, true}});
+    if(!interrupts_host_are_enabled())
+    {
+        throw std::runtime_error("FAIL: Interrupts left disabled!");
+    }
+}
+
+int main(void)
+{
+    testNotify();
+    testNoAllocation();
+    testUnsubscribe();
+    testResubscribe();
+}
+/****************************************************************/
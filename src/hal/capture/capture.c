@@ -0,0 +1,179 @@
+/*!\file capture.c
+** \author
+** \copyright
+** \brief Implementation of input capture on TCB and EVSYS.
+** \details
+**/
+/****************************************************************/
+
+#include "capture.h"
+#include "capture_config.h"
+#include "interrupts.h"
+#include "isr_profile.h"
+#include "sleep.h"
+#include <stddef.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+/****************************************************************/
+
+/* C-preprocessor's hacks: build TCB instance and vector names from
+ * CAPTURE_TCB (see timer.c for the double expansion).
+ */
+#define CAPTURE_CONCAT(a, b, c)   _CAPTURE_CONCAT(a, b, c)
+#define _CAPTURE_CONCAT(a, b, c)  a##b##c
+#define CAPTURE_TIMER             CAPTURE_CONCAT(TCB, CAPTURE_TCB, )
+#define CAPTURE_TIMER_VECT        CAPTURE_CONCAT(TCB, CAPTURE_TCB, _INT_vect)
+#define CAPTURE_TIMER_VECT_NUM    CAPTURE_CONCAT(TCB, CAPTURE_TCB, _INT_vect_num)
+
+#if (CAPTURE_BUFFER_SIZE & (CAPTURE_BUFFER_SIZE - 1)) || (CAPTURE_BUFFER_SIZE > 128)
+#error "CAPTURE_BUFFER_SIZE must be a power of 2, at most 128"
+#endif
+#define CAPTURE_BUFFER_MASK (CAPTURE_BUFFER_SIZE - 1)
+
+/* Event generator for a pin: PORT0 is the first port of the pair
+ * feeding a channel, PORT1 the second.
+ */
+#define CAPTURE_GENERATOR(port, pin) \
+    (EVSYS_GENERATOR_PORT0_PIN0_gc + (((port) & 1) * 8) + (pin))
+#define CAPTURE_CHANNEL(port) \
+    ((((port) >> 1) * 2) + CAPTURE_EVSYS_CHANNEL_OFFSET)
+
+/** Ring of captured values. Written by the ISR, read by the background. */
+static volatile uint16_t capture_buffer[CAPTURE_BUFFER_SIZE];
+static volatile uint8_t capture_head;
+static volatile uint8_t capture_tail;
+static volatile uint16_t capture_overruns;
+
+/** Capture is running: the sleep constraint is held. */
+static bool capture_armed;
+
+ISR(CAPTURE_TIMER_VECT)
+{
+    ISR_PROFILE_SCOPE(isr_profile_capture);
+    /* Reading CCMP clears the capture flag. */
+    uint16_t value = CAPTURE_TIMER.CCMP;
+    uint8_t next = (capture_head + 1) & CAPTURE_BUFFER_MASK;
+
+    sleep_note_wakeup(SLEEP_WAKEUP_CAPTURE);
+    if(next == capture_tail)
+    {
+        capture_overruns++;
+        return;
+    }
+    capture_buffer[capture_head] = value;
+    capture_head = next;
+}
+
+bool capture_start(capture_port_t port, uint8_t pin, capture_mode_t mode, bool rising)
+{
+    uint8_t cntmode;
+    interrupts_state_t sreg;
+
+    if((port > capture_port_f) || (pin > 7))
+    {
+        return false;
+    }
+    switch(mode)
+    {
+        case capture_timestamp:
+            cntmode = TCB_CNTMODE_CAPT_gc;
+            break;
+        case capture_period:
+            cntmode = TCB_CNTMODE_FRQ_gc;
+            break;
+        case capture_pulse_width:
+            cntmode = TCB_CNTMODE_PW_gc;
+            break;
+        default:
+            return false;
+    }
+
+    capture_stop();
+#ifdef CAPTURE_HIGH_PRIORITY
+    if(!interrupts_priority_elevate(CAPTURE_TIMER_VECT_NUM))
+    {
+        return false;
+    }
+#endif
+    sreg = interrupts_save_off();
+    capture_head = 0;
+    capture_tail = 0;
+    capture_overruns = 0;
+    interrupts_restore(sreg);
+
+    /* Pin as input, routed to the timer through the event system. */
+    (&PORTA + port)->DIRCLR = (1 << pin);
+    (&EVSYS.CHANNEL0)[CAPTURE_CHANNEL(port)] = CAPTURE_GENERATOR(port, pin);
+    (&EVSYS.USERTCB0)[CAPTURE_TCB] = CAPTURE_CHANNEL(port) + EVSYS_CHANNEL_CHANNEL0_gc;
+
+    /* EDGE bit inverts the event: falling edges / low pulses. */
+    CAPTURE_TIMER.CTRLB = cntmode;
+    CAPTURE_TIMER.EVCTRL = TCB_CAPTEI_bm | (rising ? 0 : TCB_EDGE_bm);
+    CAPTURE_TIMER.CNT = 0;
+    CAPTURE_TIMER.INTFLAGS = TCB_CAPT_bm;
+    CAPTURE_TIMER.INTCTRL = TCB_CAPT_bm;
+    CAPTURE_TIMER.CTRLA = CAPTURE_CLKSEL | TCB_ENABLE_bm;
+    sleep_constraint_set(CAPTURE_SLEEP_DEEPEST);
+    capture_armed = true;
+    return true;
+}
+
+void capture_stop(void)
+{
+    CAPTURE_TIMER.CTRLA = 0;
+    CAPTURE_TIMER.INTCTRL = 0;
+    (&EVSYS.USERTCB0)[CAPTURE_TCB] = EVSYS_CHANNEL_OFF_gc;
+#ifdef CAPTURE_HIGH_PRIORITY
+    interrupts_priority_release(CAPTURE_TIMER_VECT_NUM);
+#endif
+    if(capture_armed)
+    {
+        capture_armed = false;
+        sleep_constraint_release(CAPTURE_SLEEP_DEEPEST);
+    }
+}
+
+uint8_t capture_available(void)
+{
+    return (capture_head - capture_tail) & CAPTURE_BUFFER_MASK;
+}
+
+bool capture_read(uint16_t *cycles)
+{
+    uint8_t tail = capture_tail;
+
+    if((cycles == NULL) || (tail == capture_head))
+    {
+        return false;
+    }
+    /* 16-bit read from the buffer: ISR only writes slots
+     * after the head, never this one.
+     */
+    *cycles = capture_buffer[tail];
+    capture_tail = (tail + 1) & CAPTURE_BUFFER_MASK;
+    return true;
+}
+
+bool capture_read_frequency(uint32_t *hz)
+{
+    uint16_t period;
+
+    if((hz == NULL) || !capture_read(&period))
+    {
+        return false;
+    }
+    *hz = (period != 0) ? (CAPTURE_CLOCK_HZ / period) : 0;
+    return true;
+}
+
+uint16_t capture_get_overruns(void)
+{
+    uint16_t overruns;
+    interrupts_state_t sreg;
+
+    sreg = interrupts_save_off();
+    overruns = capture_overruns;
+    interrupts_restore(sreg);
+    return overruns;
+}
+/****************************************************************/
@@ -0,0 +1,110 @@
+/*!\file capture.h
+** \author
+** \copyright TODO
+** \brief Hardware input capture API
+** \details Capture module timestamps edges of an external signal in hardware.
+**          The pin is routed through the event system to a timer configured in
+**          capture mode: the timer latches its counter on each edge without any
+**          software latency or jitter. Captured values are buffered in a ring
+**          and can be read out as raw timestamps, periods (frequency) or pulse
+**          widths, expressed in cycles of the capture clock.
+**/
+/****************************************************************/
+#ifndef __CAPTURE_H
+#define __CAPTURE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+/****************************************************************/
+
+/*!    \brief Ports that can be used as capture input.
+**/
+typedef enum
+{
+    capture_port_a,
+    capture_port_b,
+    capture_port_c,
+    capture_port_d,
+    capture_port_e,
+    capture_port_f,
+} capture_port_t;
+
+/*!    \brief What is captured at each edge.
+**/
+typedef enum
+{
+    capture_timestamp,   /** Free running counter value at each edge. */
+    capture_period,      /** Cycles between two consecutive edges. */
+    capture_pulse_width, /** Cycles the signal stays in its active level. */
+} capture_mode_t;
+
+/*!    \brief Start capturing edges of a pin.
+**
+** Route the pin to the capture timer and start buffering
+** captured values. Any previously buffered value is discarded.
+** Until capture_stop, the power manager doesn't go deeper than
+** CAPTURE_SLEEP_DEEPEST (see capture_config.h).
+**
+**    \param [in] port   - port of the input pin.
+**    \param [in] pin    - bit number of the input pin in the port (0-7).
+**    \param [in] mode   - what to capture.
+**    \param [in] rising - true to capture on rising edges (timestamp, period)
+**                         or to measure high pulses (pulse width).
+**                         false for falling edges / low pulses.
+**
+**    \return true if capture was started.
+**/
+bool capture_start(capture_port_t port, uint8_t pin, capture_mode_t mode, bool rising);
+
+/*!    \brief Stop capturing.
+**
+** Buffered values can still be read after stopping.
+**
+**    \return None.
+**/
+void capture_stop(void);
+
+/*!    \brief Number of captured values waiting to be read.
+**
+**    \return Number of values in the buffer.
+**/
+uint8_t capture_available(void);
+
+/*!    \brief Read the oldest captured value.
+**
+**    \param [out] cycles - captured value in capture clock cycles
+**                          (see CAPTURE_CLOCK_HZ in capture_config.h).
+**                          Timestamps wrap at 2^16: use unsigned 16-bit
+**                          subtraction to compute the distance between two.
+**
+**    \return true if a value was read, false if buffer was empty.
+**/
+bool capture_read(uint16_t *cycles);
+
+/*!    \brief Read the oldest captured period as a frequency.
+**
+** Only meaningful in capture_period mode.
+**
+**    \param [out] hz - frequency of the signal in Hz.
+**
+**    \return true if a value was read, false if buffer was empty.
+**/
+bool capture_read_frequency(uint32_t *hz);
+
+/*!    \brief Number of captured values lost because the buffer was full.
+**
+**    \return Lost values since capture_start().
+**/
+uint16_t capture_get_overruns(void);
+
+/****************************************************************/
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CAPTURE_H */
+/****************************************************************/
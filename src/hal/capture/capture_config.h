@@ -0,0 +1,80 @@
+/*!\file capture_config.h
+** \author
+** \copyright TODO
+** \brief Static configuration for input capture module.
+** \details This is a private header that can be used to statically configure
+**          the megavr implementation of the driver.
+**/
+/****************************************************************/
+#ifndef __CAPTURE_CONFIG_H
+#define __CAPTURE_CONFIG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+/****************************************************************/
+
+/*!    \brief Timer used for capture.
+**
+** Index of the TCB instance (TCB<n>). Arduino core uses TCB3 for millis()
+** and TCB0, TCB1 for PWM on pins 6 and 3: TCB2 is free.
+**/
+#define CAPTURE_TCB 2
+
+/*!    \brief Clock source for the capture timer.
+**
+** Can be any of the following labels (see TCB_CLKSEL_t in avr/io.h):
+**
+** TCB_CLKSEL_CLKDIV1_gc => CLK_PER (cycle accurate, 4ms max range @16MHz)
+** TCB_CLKSEL_CLKDIV2_gc => CLK_PER/2
+** TCB_CLKSEL_CLKTCA_gc => Same clock as TCA (CLK_PER/64 with Arduino core)
+**/
+#define CAPTURE_CLKSEL TCB_CLKSEL_CLKDIV1_gc
+
+/*!    \brief Frequency of the capture clock.
+**
+** Must match CAPTURE_CLKSEL.
+**/
+#define CAPTURE_CLOCK_HZ F_CPU
+
+/*!    \brief Event channel used to route the pin.
+**
+** Each pair of event channels can only be fed by a pair of ports:
+** channels 0-1 by ports A-B, 2-3 by C-D, 4-5 by E-F.
+** Select which channel of the pair (0 or 1) is used.
+**/
+#define CAPTURE_EVSYS_CHANNEL_OFFSET 1
+
+/*!    \brief Number of captured values that can be buffered.
+**
+** Must be a power of 2, at most 128.
+**/
+#define CAPTURE_BUFFER_SIZE 16
+
+/*!    \brief Run the capture interrupt at high priority.
+**
+** Define to assign level 1 priority to the capture vector while capture
+** is running, so that back to back edges are buffered even when other
+** ISRs are slow. Only one vector can be at level 1: capture_start fails
+** if it is taken.
+**/
+// #define CAPTURE_HIGH_PRIORITY
+
+/*!    \brief Deepest sleep mode while capture is running.
+**
+** Sleep constraint (see sleep_constraint_set) held from capture_start
+** to capture_stop. The capture timer is clocked from CLK_PER, which
+** stops in standby: anything deeper than idle misses the edges.
+**/
+#define CAPTURE_SLEEP_DEEPEST sleep_mode_idle
+
+/****************************************************************/
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CAPTURE_CONFIG_H */
+/****************************************************************/
@@ -2,7 +2,18 @@
 ** \author 
 ** \copyright TODO
 ** \brief Provide interrupts functionality that needs to be exported to other subsystems
-** \details 
+** \details Critical sections save the interrupt state on entry and restore
+**          it on exit, so they can be safely nested (i.e. a critical section
+**          in a function called from another critical section or from an ISR).
+**          C code uses interrupts_save_off/interrupts_restore, C++ code
+**          the InterruptsGuard RAII class.
+**
+**          On the chip, the priority API assigns level 1 (high priority)
+**          to a latency sensitive vector, selects static or round-robin
+**          scheduling of level 0 and reports the current execution level.
+**
+**          On the host (unit tests) the primitives are stubbed by
+**          interrupts_host_stubs.c.
 **/
 /****************************************************************/
 #ifndef __INTERRUPTS_H
@@ -14,24 +25,231 @@ extern "C" {
 
 #include <inttypes.h>
 #include <stdbool.h>
+#ifdef __AVR__
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#endif
 /****************************************************************/
 
+/*!\brief Saved interrupt state.
+**
+** Value returned by interrupts_save_off, to be passed to interrupts_restore.
+**/
+typedef uint8_t interrupts_state_t;
+
+#ifdef __AVR__
+/*!\brief Enter a critical section.
+**
+**    Save the interrupt state (status register) and disable interrupts.
+**
+**    \return State to restore with interrupts_restore.
+**/
+static inline interrupts_state_t interrupts_save_off(void)
+{
+    interrupts_state_t state = SREG;
+
+    cli();
+    return state;
+}
+
+/*!\brief Leave a critical section.
+**
+**    Restore the interrupt state saved by interrupts_save_off: interrupts
+**    are only enabled again if they were enabled on entry.
+**
+**    \param [in] state - value returned by interrupts_save_off.
+**/
+static inline void interrupts_restore(interrupts_state_t state)
+{
+    /* Don't let the compiler move memory accesses out of the section. */
+    __asm__ __volatile__ ("" ::: "memory");
+    SREG = state;
+}
+#else
+interrupts_state_t interrupts_save_off(void);
+void interrupts_restore(interrupts_state_t state);
+#endif /* __AVR__ */
+
+#ifdef __AVR__
+/*!\brief Interrupt execution level.
+**/
+typedef enum
+{
+    interrupts_level_none, /**< Not in an ISR. */
+    interrupts_level_0,    /**< Normal priority ISR. */
+    interrupts_level_1,    /**< High priority ISR (see interrupts_priority_elevate). */
+    interrupts_level_nmi   /**< Non maskable interrupt. */
+} interrupts_level_t;
+
+/*!\brief No vector is assigned to level 1.
+**/
+#define INTERRUPTS_VECTOR_NONE 0
+
+/*!\brief Get the current execution level.
+**
+**    \return the highest level being executed: a level 1 ISR that
+**            preempted a level 0 one returns interrupts_level_1.
+**/
+static inline interrupts_level_t interrupts_execution_level(void)
+{
+    uint8_t status = CPUINT.STATUS;
+
+    if(status & CPUINT_NMIEX_bm)
+    {
+        return interrupts_level_nmi;
+    }
+    if(status & CPUINT_LVL1EX_bm)
+    {
+        return interrupts_level_1;
+    }
+    if(status & CPUINT_LVL0EX_bm)
+    {
+        return interrupts_level_0;
+    }
+    return interrupts_level_none;
+}
+
+/*!\brief Assign level 1 (high) priority to a vector.
+**
+**    A level 1 ISR preempts any level 0 one. The chip supports a single
+**    level 1 vector: the call fails if another vector already owns it.
+**    Use for latency sensitive handlers (i.e. RTC_CNT_vect_num).
+**
+**    \param [in] vect_num - vector number (<vector>_num in avr/io.h).
+**
+**    \return true if vect_num owns level 1.
+**/
+static inline bool interrupts_priority_elevate(uint8_t vect_num)
+{
+    interrupts_state_t state = interrupts_save_off();
+    uint8_t owner = CPUINT.LVL1VEC;
+    bool ok = (owner == INTERRUPTS_VECTOR_NONE) || (owner == vect_num);
+
+    if(ok)
+    {
+        CPUINT.LVL1VEC = vect_num;
+    }
+    interrupts_restore(state);
+    return ok;
+}
+
+/*!\brief Take a vector back to level 0.
+**
+**    Does nothing if vect_num doesn't own level 1.
+**
+**    \param [in] vect_num - vector number passed to interrupts_priority_elevate.
+**/
+static inline void interrupts_priority_release(uint8_t vect_num)
+{
+    interrupts_state_t state = interrupts_save_off();
+
+    if(CPUINT.LVL1VEC == vect_num)
+    {
+        CPUINT.LVL1VEC = INTERRUPTS_VECTOR_NONE;
+    }
+    interrupts_restore(state);
+}
+
+/*!\brief Temporarily move level 1 to a vector.
+**
+**    Unlike interrupts_priority_elevate, the current owner is evicted.
+**    Meant for drivers that must let their own ISR run from inside
+**    another ISR (i.e. UART transmit). Give level 1 back by calling
+**    again with the returned value.
+**
+**    \param [in] vect_num - vector number, or INTERRUPTS_VECTOR_NONE.
+**
+**    \return previous level 1 vector.
+**/
+static inline uint8_t interrupts_priority_swap(uint8_t vect_num)
+{
+    uint8_t prev = CPUINT.LVL1VEC;
+
+    CPUINT.LVL1VEC = vect_num;
+    return prev;
+}
+
+/*!\brief Get the vector owning level 1.
+**
+**    \return vector number, INTERRUPTS_VECTOR_NONE if none.
+**/
+static inline uint8_t interrupts_priority_elevated(void)
+{
+    return CPUINT.LVL1VEC;
+}
+
+/*!\brief Select level 0 scheduling.
+**
+**    With static scheduling (default) pending level 0 interrupts are
+**    served lowest vector number first, so a busy low vector can starve
+**    the others. With round-robin the last served vector gets the lowest
+**    priority.
+**
+**    \param [in] enable - true for round-robin, false for static.
+**/
+static inline void interrupts_round_robin(bool enable)
+{
+    uint8_t ctrla = CPUINT.CTRLA & ~CPUINT_LVL0RR_bm;
+
+    if(enable)
+    {
+        ctrla |= CPUINT_LVL0RR_bm;
+    }
+    _PROTECTED_WRITE(CPUINT.CTRLA, ctrla);
+}
+
+/*!\brief Give the highest level 0 priority to a vector.
+**
+**    Static scheduling only: vectors following vect_num are served
+**    next, lower vector numbers last.
+**
+**    \param [in] vect_num - vector number (<vector>_num in avr/io.h).
+**/
+static inline void interrupts_level0_first(uint8_t vect_num)
+{
+    CPUINT.LVL0PRI = vect_num - 1;
+}
+#endif /* __AVR__ */
+
 /*!\brief Disable interrupts
 **
 **    Note: interrupts_off, interrupts_on implementation is not safe
-**          to nesting. Calls shall not be nested.
+**          to nesting. Calls shall not be nested. Prefer
+**          interrupts_save_off/interrupts_restore.
 **/
 #define interrupts_off() cli()
 
 /*!\brief Enable interrupts
 **
 **    Note: interrupts_off, interrupts_on implementation is not safe
-**          to nesting. Calls shall not be nested.
+**          to nesting. Calls shall not be nested. Prefer
+**          interrupts_save_off/interrupts_restore.
 **/
 #define interrupts_on() sei()
 
 #ifdef __cplusplus
 }
+
+/*!\brief Critical section guard.
+**
+** Disable interrupts for the lifetime of the object and restore
+** the previous interrupt state when it goes out of scope. I.e.:
+**
+** {
+**     InterruptsGuard guard;
+**     shared++;
+** }
+**/
+class InterruptsGuard
+{
+public:
+    InterruptsGuard(void) : state(interrupts_save_off()) {}
+    ~InterruptsGuard(void) { interrupts_restore(state); }
+    InterruptsGuard(const InterruptsGuard &) = delete;
+    InterruptsGuard &operator=(const InterruptsGuard &) = delete;
+private:
+    interrupts_state_t state;
+};
 #endif
 
 #endif /* __INTERRUPTS_H */
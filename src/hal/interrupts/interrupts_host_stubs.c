@@ -0,0 +1,39 @@
+/*!\file interrupts_host_stubs.c
+** \author
+** \copyright
+** \brief Stubs to "simulate" interrupts critical sections on the host.
+** \details
+**/
+/****************************************************************/
+#include "interrupts_host_stubs.h"
+/****************************************************************/
+
+/** Simulated global interrupt enable. Enabled as after init(). */
+static bool interrupts_enabled = true;
+/** Critical sections entered so far. */
+static uint32_t sections = 0;
+
+interrupts_state_t interrupts_save_off(void)
+{
+    interrupts_state_t state = interrupts_enabled;
+
+    interrupts_enabled = false;
+    sections++;
+    return state;
+}
+
+void interrupts_restore(interrupts_state_t state)
+{
+    interrupts_enabled = (state != 0);
+}
+
+bool interrupts_host_are_enabled(void)
+{
+    return interrupts_enabled;
+}
+
+uint32_t interrupts_host_get_sections(void)
+{
+    return sections;
+}
+/****************************************************************/
@@ -0,0 +1,36 @@
+/*!\file interrupts_host_stubs.h
+** \author
+** \copyright
+** \brief Stubs to "simulate" interrupts critical sections on the host.
+** \details A software flag simulates the global interrupt enable.
+**
+**          This header only contains declaration for "helper"
+**          functions to run the stub infrastructure.
+**          IT NEEDS ONLY TO BE INCLUDED IN HOST TESTS.
+**          Stubbed API is still declared in interrupts.h.
+**/
+/****************************************************************/
+
+#ifndef __INTERRUPTS_HOST_STUBS_H
+#define __INTERRUPTS_HOST_STUBS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "interrupts.h"
+
+/*!    \brief Check if simulated interrupts are enabled.
+**/
+bool interrupts_host_are_enabled(void);
+
+/*!    \brief Number of critical sections entered so far.
+**/
+uint32_t interrupts_host_get_sections(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __INTERRUPTS_HOST_STUBS_H */
+/****************************************************************/
@@ -0,0 +1,146 @@
+/*!\file isr_profile.c
+** \author
+** \copyright
+** \brief Implementation of the ISR profiler on a free-running TCB.
+** \details
+**/
+/****************************************************************/
+
+#include "isr_profile.h"
+#include "isr_profile_config.h"
+#include "interrupts.h"
+#include <avr/io.h>
+/****************************************************************/
+
+#ifdef ISR_PROFILE
+
+/* C-preprocessor's hacks: build TCB instance name from
+ * ISR_PROFILE_TCB (see timer.c for the double expansion).
+ */
+#define ISR_PROFILE_CONCAT(a, b)  _ISR_PROFILE_CONCAT(a, b)
+#define _ISR_PROFILE_CONCAT(a, b) a##b
+#define ISR_PROFILE_TIMER         ISR_PROFILE_CONCAT(TCB, ISR_PROFILE_TCB)
+
+/** Statistics. Written by the ISRs, read by the background. */
+static volatile struct isr_profile_stats stats[ISR_PROFILE_VECTORS];
+/** Number of profiled ISRs currently running. */
+static volatile uint8_t depth;
+
+/*!    \brief Clear the statistics. Caller disables interrupts.
+**/
+static void isr_profile_clear(void)
+{
+    uint8_t i;
+
+    for(i = 0; i < ISR_PROFILE_VECTORS; i++)
+    {
+        stats[i].count = 0;
+        stats[i].total_cycles = 0;
+        stats[i].min_cycles = 0xFFFF;
+        stats[i].max_cycles = 0;
+        stats[i].nested = 0;
+        stats[i].elevated = 0;
+    }
+}
+
+void isr_profile_init(void)
+{
+    interrupts_state_t sreg = interrupts_save_off();
+
+    /* Periodic interrupt mode without interrupt: CNT counts CLK_PER
+     * cycles from 0 to CCMP and wraps, 16 bit arithmetic does the rest.
+     */
+    ISR_PROFILE_TIMER.CTRLA = 0;
+    ISR_PROFILE_TIMER.CTRLB = TCB_CNTMODE_INT_gc;
+    ISR_PROFILE_TIMER.INTCTRL = 0;
+    ISR_PROFILE_TIMER.CCMP = 0xFFFF;
+    ISR_PROFILE_TIMER.CNT = 0;
+    ISR_PROFILE_TIMER.CTRLA = TCB_CLKSEL_CLKDIV1_gc | TCB_ENABLE_bm;
+    depth = 0;
+    isr_profile_clear();
+    interrupts_restore(sreg);
+}
+
+void isr_profile_reset(void)
+{
+    interrupts_state_t sreg = interrupts_save_off();
+
+    isr_profile_clear();
+    interrupts_restore(sreg);
+}
+
+bool isr_profile_read(isr_profile_vector_t id, struct isr_profile_stats *out)
+{
+    interrupts_state_t sreg;
+
+    if(id >= ISR_PROFILE_VECTORS)
+    {
+        return false;
+    }
+    sreg = interrupts_save_off();
+    out->count = stats[id].count;
+    out->total_cycles = stats[id].total_cycles;
+    out->min_cycles = stats[id].min_cycles;
+    out->max_cycles = stats[id].max_cycles;
+    out->nested = stats[id].nested;
+    out->elevated = stats[id].elevated;
+    interrupts_restore(sreg);
+    return true;
+}
+
+struct isr_profile_frame isr_profile_enter(isr_profile_vector_t id)
+{
+    struct isr_profile_frame frame;
+
+    /* Timestamp first: keep the profiler out of the measure. */
+    frame.start = ISR_PROFILE_TIMER.CNT;
+    frame.id = id;
+    if(depth != 0)
+    {
+        stats[id].nested++;
+    }
+    if(CPUINT.STATUS & CPUINT_LVL1EX_bm)
+    {
+        stats[id].elevated++;
+    }
+    depth++;
+    return frame;
+}
+
+void isr_profile_exit(const struct isr_profile_frame *frame)
+{
+    uint16_t cycles = ISR_PROFILE_TIMER.CNT - frame->start;
+    volatile struct isr_profile_stats *s = &stats[frame->id];
+
+    depth--;
+    s->count++;
+    s->total_cycles += cycles;
+    if(cycles < s->min_cycles)
+    {
+        s->min_cycles = cycles;
+    }
+    if(cycles > s->max_cycles)
+    {
+        s->max_cycles = cycles;
+    }
+}
+
+#else /* ISR_PROFILE */
+
+void isr_profile_init(void)
+{
+}
+
+void isr_profile_reset(void)
+{
+}
+
+bool isr_profile_read(isr_profile_vector_t id, struct isr_profile_stats *out)
+{
+    (void)id;
+    (void)out;
+    return false;
+}
+
+#endif /* ISR_PROFILE */
+/****************************************************************/
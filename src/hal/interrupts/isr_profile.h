@@ -0,0 +1,146 @@
+/*!\file isr_profile.h
+** \author
+** \copyright TODO
+** \brief Opt-in execution time profiler for interrupt service routines.
+** \details Profiled ISRs start with ISR_PROFILE_SCOPE(id): the current
+**          value of a free-running TCB (see isr_profile_config.h) is
+**          sampled on entry and again when the ISR body is left, also
+**          through an early return. For each vector the profiler keeps
+**          min/max/total cycles, the number of runs, how many times it
+**          preempted another profiled ISR (nested) and how many times
+**          it ran at level 1 priority (elevated).
+**
+**          Profiling is enabled by building with ISR_PROFILE defined
+**          (see TARGET_DEFINES in the target .inc file). When it is not
+**          defined ISR_PROFILE_SCOPE expands to nothing, no timer is
+**          claimed and isr_profile.c is empty: it costs zero.
+**
+**          Cycles are measured from the first statement of the ISR body:
+**          the register save/restore done by the compiler and the
+**          interrupt response time are not included, the time spent in
+**          ISRs preempting the profiled one is. Durations wrap after
+**          2^16 cycles (4ms @16MHz).
+**/
+/****************************************************************/
+#ifndef __ISR_PROFILE_H
+#define __ISR_PROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+/****************************************************************/
+
+/*!    \brief Profiled vectors.
+**/
+typedef enum
+{
+    isr_profile_rtc_cnt,
+    isr_profile_rtc_pit,
+    isr_profile_capture,
+    isr_profile_serial_rxc,
+    isr_profile_serial_dre,
+    isr_profile_serial1_rxc,
+    isr_profile_serial1_dre,
+    isr_profile_serial2_rxc,
+    isr_profile_serial2_dre,
+    isr_profile_serial3_rxc,
+    isr_profile_serial3_dre,
+    isr_profile_port_a,
+    isr_profile_port_b,
+    isr_profile_port_c,
+    isr_profile_port_d,
+    isr_profile_port_e,
+    isr_profile_port_f,
+    ISR_PROFILE_VECTORS
+} isr_profile_vector_t;
+
+/*!    \brief Statistics of a profiled vector.
+**/
+struct isr_profile_stats
+{
+    uint32_t count;        /**< Number of completed runs. */
+    uint32_t total_cycles; /**< Sum of all the run durations. */
+    uint16_t min_cycles;   /**< Shortest run, 0xFFFF if never run. */
+    uint16_t max_cycles;   /**< Longest run. */
+    uint16_t nested;       /**< Runs that preempted another profiled ISR. */
+    uint16_t elevated;     /**< Runs at level 1 (high) priority. */
+};
+
+/*!    \brief Book-keeping of a running ISR. Used by ISR_PROFILE_SCOPE.
+**/
+struct isr_profile_frame
+{
+    isr_profile_vector_t id;
+    uint16_t start;
+};
+
+#ifdef ISR_PROFILE
+/*!    \brief Profile the enclosing ISR.
+**
+** Place as first statement of the ISR body. I.e.:
+**
+** ISR(RTC_CNT_vect)
+** {
+**     ISR_PROFILE_SCOPE(isr_profile_rtc_cnt);
+**     ...
+** }
+**/
+#define ISR_PROFILE_SCOPE(id) \
+    struct isr_profile_frame __isr_profile_frame \
+        __attribute__ ((cleanup (isr_profile_exit))) = isr_profile_enter(id)
+#else
+#define ISR_PROFILE_SCOPE(id)
+#endif
+
+/*!    \brief Initialise the profiler.
+**
+**    Start the free-running timer and clear the statistics.
+**    Does nothing unless ISR_PROFILE is defined.
+**
+**    \return None
+**/
+void isr_profile_init(void);
+
+/*!    \brief Clear the statistics of all vectors.
+**
+**    \return None
+**/
+void isr_profile_reset(void);
+
+/*!    \brief Read the statistics of a vector.
+**
+**    \param [in] id     - vector to read.
+**    \param [out] stats - copy of the statistics, taken atomically.
+**
+**    \return false if id is not valid or profiling is disabled.
+**/
+bool isr_profile_read(isr_profile_vector_t id, struct isr_profile_stats *stats);
+
+/*!    \brief ISR_PROFILE_SCOPE back-end. Not meant to be called by users.
+**/
+struct isr_profile_frame isr_profile_enter(isr_profile_vector_t id);
+void isr_profile_exit(const struct isr_profile_frame *frame);
+
+/****************************************************************/
+#ifdef __cplusplus
+}
+
+namespace arduino { class Print; }
+
+/*!    \brief Print the statistics table.
+**
+** One line per vector that ran at least once, all values in cpu cycles.
+** Prints nothing if profiling is disabled.
+**
+**    \param [in] out - where to print (i.e. Serial).
+**
+**    \return None
+**/
+void isr_profile_print(arduino::Print &out);
+#endif
+
+#endif /* __ISR_PROFILE_H */
+/****************************************************************/
@@ -0,0 +1,36 @@
+/*!\file isr_profile_config.h
+** \author
+** \copyright TODO
+** \brief Static configuration for the ISR profiler.
+** \details This is a private header that can be used to statically configure
+**          the megavr implementation of the profiler. Profiling itself is
+**          enabled with the ISR_PROFILE build define (see isr_profile.h).
+**/
+/****************************************************************/
+#ifndef __ISR_PROFILE_CONFIG_H
+#define __ISR_PROFILE_CONFIG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+/****************************************************************/
+
+/*!    \brief Free-running timer used for timestamps.
+**
+** Index of the TCB instance (TCB<n>). Arduino core uses TCB3 for millis()
+** and TCB1 for tone() (USE_TIMERB1 in Tone.cpp), TCB2 is used by the
+** capture module: TCB0 is taken by default, losing PWM on pin 6 while
+** profiling is enabled.
+**/
+#define ISR_PROFILE_TCB 0
+
+/****************************************************************/
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ISR_PROFILE_CONFIG_H */
+/****************************************************************/
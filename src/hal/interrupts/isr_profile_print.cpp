@@ -0,0 +1,58 @@
+/*!\file isr_profile_print.cpp
+** \author
+** \copyright
+** \brief Serialisation of the ISR profiler statistics over Arduino Print.
+** \details
+**/
+/****************************************************************/
+
+#include "isr_profile.h"
+#include <Arduino.h>
+/****************************************************************/
+
+/** Vector names, same order as isr_profile_vector_t. In flash. */
+static const char names[ISR_PROFILE_VECTORS][12] PROGMEM =
+{
+    "rtc_cnt", "rtc_pit", "capture",
+    "serial_rxc", "serial_dre", "serial1_rxc", "serial1_dre",
+    "serial2_rxc", "serial2_dre", "serial3_rxc", "serial3_dre",
+    "port_a", "port_b", "port_c", "port_d", "port_e", "port_f",
+};
+
+/** Header then one line per vector, i.e.:
+ ** isr	count	min	max	avg	nested	elevated
+ ** rtc_cnt	1200	61	410	75	0	0
+ **/
+void isr_profile_print(arduino::Print &out)
+{
+    struct isr_profile_stats s;
+    uint8_t i;
+
+    if(!isr_profile_read((isr_profile_vector_t)0, &s))
+    {
+        return;
+    }
+    out.println(F("isr\tcount\tmin\tmax\tavg\tnested\televated"));
+    for(i = 0; i < ISR_PROFILE_VECTORS; i++)
+    {
+        isr_profile_read((isr_profile_vector_t)i, &s);
+        if(s.count == 0)
+        {
+            continue;
+        }
+        out.print((const __FlashStringHelper *)names[i]);
+        out.print('\t');
+        out.print(s.count);
+        out.print('\t');
+        out.print(s.min_cycles);
+        out.print('\t');
+        out.print(s.max_cycles);
+        out.print('\t');
+        out.print(s.total_cycles / s.count);
+        out.print('\t');
+        out.print(s.nested);
+        out.print('\t');
+        out.println(s.elevated);
+    }
+}
+/****************************************************************/
@@ -7,8 +7,13 @@
 /****************************************************************/
 
 #include "reset.h"
+#include "reset_config.h"
+#include "interrupts.h"
+#include "timer.h"
 #include <stddef.h>
+#include <avr/interrupt.h>
 #include <avr/wdt.h>
+#include <util/crc16.h>
 /****************************************************************/
 
 struct reset_dump
@@ -23,6 +28,66 @@ struct reset_dump
  **/
 static struct reset_dump last_reset __attribute__ ((section (".noinit")));
 
+/** Context stored by reset_capture, to be added to the ring at next boot. */
+struct reset_capture_dump
+{
+    struct reset_record record;
+    uint16_t crc;
+};
+static struct reset_capture_dump capture __attribute__ ((section (".noinit")));
+
+/** Crash-dump ring. Records are added at "head", oldest ones overwritten. */
+struct reset_dump_ring
+{
+    struct reset_record records[RESET_DUMP_RECORDS];
+    uint8_t head;
+    uint8_t count;
+    uint16_t crc;
+};
+static struct reset_dump_ring ring __attribute__ ((section (".noinit")));
+
+/** End of static data (.noinit included), from avr-libc linker script. */
+extern uint8_t _end;
+
+/** CRC-CCITT of a preserved RAM object */
+static uint16_t reset_crc(const void *data, uint8_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint16_t crc = 0xFFFF;
+
+    while(size--)
+    {
+        crc = _crc_ccitt_update(crc, *p++);
+    }
+    return crc;
+}
+
+/** Paint the free RAM between the end of static data and the stack.
+ ** Runs from .init3, before main and before .data/.bss initialisation:
+ ** no stack frame, no call.
+ **/
+static void __attribute__ ((naked, used, section (".init3"))) reset_paint_stack(void)
+{
+    uint8_t *p = &_end;
+
+    while(p < (uint8_t *)SP)
+    {
+        *p++ = RESET_STACK_PAINT;
+    }
+}
+
+/** Stack high-water mark in bytes: scan the paint from the bottom. */
+static uint16_t reset_stack_peak(void)
+{
+    const uint8_t *p = &_end;
+
+    while((p <= (const uint8_t *)RAMEND) && (*p == RESET_STACK_PAINT))
+    {
+        p++;
+    }
+    return (uint16_t)((const uint8_t *)RAMEND - p + 1);
+}
+
 /** Read the reset cause from hardware, store it in the preserved RAM and
  ** clear the register.
  **/
@@ -83,9 +148,37 @@ static void dump_last_reset(void)
     }
 }
 
+/** Add the record of the last reset to the crash-dump ring. */
+static void dump_to_ring(void)
+{
+    struct reset_record rec = {0};
+
+    if(reset_crc(&ring, offsetof(struct reset_dump_ring, crc)) != ring.crc)
+    {
+        /* First boot or corrupted: start over. */
+        ring.head = 0;
+        ring.count = 0;
+    }
+    if(reset_crc(&capture.record, sizeof(capture.record)) == capture.crc)
+    {
+        rec = capture.record;
+    }
+    rec.cause = last_reset.cause;
+    ring.records[ring.head] = rec;
+    ring.head = (ring.head + 1) % RESET_DUMP_RECORDS;
+    if(ring.count < RESET_DUMP_RECORDS)
+    {
+        ring.count++;
+    }
+    ring.crc = reset_crc(&ring, offsetof(struct reset_dump_ring, crc));
+    /* Capture is consumed: invalidate it. */
+    capture.crc = ~reset_crc(&capture.record, sizeof(capture.record));
+}
+
 void reset_init(void)
 {
     dump_last_reset();
+    dump_to_ring();
 }
 
 reset_cause_t reset_read_last(sw_reset_t *sw_code)
@@ -106,7 +199,61 @@ void reset(sw_reset_t sw_reset_code)
      * after reset and it will be possible to read it.
      */
     last_reset.sw_code = sw_reset_code;
+    reset_capture(sw_reset_code, (uint16_t)__builtin_return_address(0));
     /* Issue software reset. */
     _PROTECTED_WRITE(RSTCTRL.SWRR, RSTCTRL_SWRE_bm);
 }
+
+void reset_capture(sw_reset_t code, uint16_t pc)
+{
+    interrupts_state_t sreg;
+
+    sreg = interrupts_save_off();
+    capture.record.cause = reset_undefined;
+    capture.record.code = code;
+    capture.record.uptime_tick = timer_get_tick();
+    capture.record.pc = pc;
+    capture.record.stack_peak = reset_stack_peak();
+    capture.crc = reset_crc(&capture.record, sizeof(capture.record));
+    interrupts_restore(sreg);
+}
+
+uint8_t reset_dump_count(void)
+{
+    return ring.count;
+}
+
+bool reset_dump_read(uint8_t index, struct reset_record *rec)
+{
+    if((index >= ring.count) || (rec == NULL))
+    {
+        return false;
+    }
+    /* head is the next free slot: last record is just before it. */
+    *rec = ring.records[(ring.head + RESET_DUMP_RECORDS - 1 - index) % RESET_DUMP_RECORDS];
+    return true;
+}
+
+/** Called from the unhandled interrupt handler with the stack pointer
+ ** at interrupt entry: the interrupted program counter is on top.
+ **/
+static void __attribute__ ((noinline, noreturn)) reset_on_bad_isr(uint16_t sp)
+{
+    const uint8_t *stack = (const uint8_t *)sp;
+
+    /* Return address is pushed low byte first: high byte is on top. */
+    reset_capture(SW_RESET_BAD_ISR, ((uint16_t)stack[1] << 8) | stack[2]);
+    last_reset.sw_code = SW_RESET_BAD_ISR;
+    _PROTECTED_WRITE(RSTCTRL.SWRR, RSTCTRL_SWRE_bm);
+    for(;;);
+}
+
+/* Default avr-libc handler jumps to address 0 without resetting the
+ * hardware. Naked: SP is exactly as left by the interrupt.
+ */
+ISR(BADISR_vect, ISR_NAKED)
+{
+    __asm__ __volatile__ ("clr __zero_reg__");
+    reset_on_bad_isr(SP);
+}
 /****************************************************************/
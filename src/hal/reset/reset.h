@@ -4,6 +4,8 @@
 ** \brief System reset module
 ** \detail This module initialise system reset of the MCU, provides
 **         software reset and allows to read out last reset cause.
+**         A crash-dump ring, preserved across resets, holds a record
+**         for each of the last resets for field diagnosis.
 **/
 /****************************************************************/
 #ifndef __RESET_H
@@ -24,6 +26,13 @@ extern "C" {
 **/
 #define SW_RESET_UNSPECIFIED 0
 
+/*!    \brief Software reset code for unhandled interrupts
+**
+** Code of the software reset issued when an interrupt without handler
+** fires. The record pc holds the interrupted program counter.
+**/
+#define SW_RESET_BAD_ISR 0xFF
+
 /*!    \brief Possible causes of reset.
 **/
 typedef enum
@@ -77,9 +86,71 @@ reset_cause_t reset_read_last(sw_reset_t *sw_code);
 **    \return None
 **/
 void reset(sw_reset_t sw_reset_code);
+
+/*!    \brief Reset record.
+**
+** One entry of the crash-dump ring. Fields other than cause are
+** only meaningful if a capture took place before the reset (see
+** reset_capture), they are 0 otherwise.
+**/
+struct reset_record
+{
+    uint8_t cause;        /**< reset_cause_t of the reset. */
+    sw_reset_t code;      /**< Code passed to reset_capture/reset. */
+    uint32_t uptime_tick; /**< System timer tick (timer_get_tick()) at capture. */
+    uint16_t pc;          /**< Program counter or return address (word address) at capture. */
+    uint16_t stack_peak;  /**< Stack high-water mark in bytes at capture (includes heap). */
+};
+
+/*!    \brief Capture the context before an expected reset.
+**
+** Store code, pc, uptime and stack high-water mark in preserved RAM.
+** They are added to the crash-dump ring with the cause of the next reset.
+** Use i.e. from the watchdog early warning callback. reset() and the
+** unhandled interrupt handler call it too.
+** Safe to call from interrupt context.
+**
+**    \param [in] code - status code to store (i.e. watchdog culprit).
+**    \param [in] pc   - program counter or return address of interest,
+**                       0 if not available.
+**
+**    \return None
+**/
+void reset_capture(sw_reset_t code, uint16_t pc);
+
+/*!    \brief Number of records in the crash-dump ring.
+**
+** Shall be called after reset_init(). The record of the last reset
+** is always present.
+**
+**    \return Number of valid records (up to RESET_DUMP_RECORDS).
+**/
+uint8_t reset_dump_count(void);
+
+/*!    \brief Read a record from the crash-dump ring.
+**
+**    \param [in] index - 0 for the last reset, 1 for the one before, ...
+**    \param [out] rec  - record.
+**
+**    \return false if index is out of range.
+**/
+bool reset_dump_read(uint8_t index, struct reset_record *rec);
 /****************************************************************/
 #ifdef __cplusplus
 }
+
+namespace arduino { class Print; }
+
+/*!    \brief Print the crash-dump ring.
+**
+** Serialise all the records, one per line, from the last reset
+** (i.e. on Serial after boot).
+**
+**    \param [in] out - where to print.
+**
+**    \return None
+**/
+void reset_dump_print(arduino::Print &out);
 #endif
 
 #endif /* __RESET_H */
@@ -0,0 +1,40 @@
+/*!\file reset_config.h
+** \author 
+** \copyright TODO
+** \brief Static configuration for reset module
+** \detail This is a private header that can be used to statically configure
+**          the megavr implementation of the driver.
+**/
+/****************************************************************/
+#ifndef __RESET_CONFIG_H
+#define __RESET_CONFIG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+/****************************************************************/
+
+/*!    \brief Number of reset records
+**
+** Number of reset records preserved across resets in the crash-dump
+** ring. Each record takes 10 bytes of .noinit RAM.
+**/
+#define RESET_DUMP_RECORDS 4
+
+/*!    \brief Stack paint pattern
+**
+** Free RAM is filled with this value at boot so that the stack
+** high-water mark can be measured at capture time.
+**/
+#define RESET_STACK_PAINT 0xC5
+
+/****************************************************************/
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RESET_CONFIG_H */
+/****************************************************************/
@@ -0,0 +1,37 @@
+/*!\file reset_print.cpp
+** \author
+** \copyright
+** \brief Serialisation of the crash-dump ring over Arduino Print.
+** \details
+**/
+/****************************************************************/
+
+#include "reset.h"
+#include <Arduino.h>
+/****************************************************************/
+
+/** One line per record, i.e.:
+ ** reset[0]: cause=3 code=2 uptime=51234 pc=0x1a2b stack=412
+ **/
+void reset_dump_print(arduino::Print &out)
+{
+    struct reset_record rec;
+    uint8_t i;
+
+    for(i = 0; reset_dump_read(i, &rec); i++)
+    {
+        out.print(F("reset["));
+        out.print(i);
+        out.print(F("]: cause="));
+        out.print(rec.cause);
+        out.print(F(" code="));
+        out.print(rec.code);
+        out.print(F(" uptime="));
+        out.print(rec.uptime_tick);
+        out.print(F(" pc=0x"));
+        out.print(rec.pc, HEX);
+        out.print(F(" stack="));
+        out.println(rec.stack_peak);
+    }
+}
+/****************************************************************/
@@ -8,133 +8,309 @@
 
 #include "sleep.h"
 #include "sleep_config.h"
+#include "interrupts.h"
+#include "timer.h"
 #include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
 #include <avr/sleep.h>
 /****************************************************************/
 
-struct sleep_config_handlers
+/* Residency and charge are measured on timer_get_tick(): it has to be
+ * monotonic.
+ */
+#ifndef TIMER_FREE_RUNNING
+#error "sleep module requires TIMER_FREE_RUNNING (see timer_config.h)"
+#endif
+
+/** Declare the handlers listed in sleep_config.h */
+#define SLEEP_HANDLER(h) void h(void);
+SLEEP_ON_INIT_HANDLERS
+SLEEP_ON_ENTER_HANDLERS
+SLEEP_ON_EXIT_HANDLERS
+#undef SLEEP_HANDLER
+
+/** Handlers are called directly, lists are expanded in place */
+#define SLEEP_HANDLER(h) h();
+
+/** Hardware sleep mode for each sleep_mode_t */
+static const uint8_t sleep_mode_hw[SLEEP_MODES] =
+{
+    SLEEP_MODE_IDLE,
+    SLEEP_MODE_STANDBY,
+    SLEEP_MODE_PWR_DOWN
+};
+
+/** Minimum residency in ticks for each sleep_mode_t */
+static const uint32_t sleep_min_residency[SLEEP_MODES] =
+{
+    0,
+    SLEEP_STANDBY_MIN_RESIDENCY_TICKS,
+    SLEEP_POWER_DOWN_MIN_RESIDENCY_TICKS
+};
+
+/** Number of active constraints for each sleep_mode_t.
+ ** constraints[m] counts the drivers that don't allow anything deeper
+ ** than m.
+ **/
+static volatile uint8_t constraints[SLEEP_MODES];
+
+/** Supply current in nA for each sleep_mode_t */
+static const uint32_t sleep_current_na[SLEEP_MODES] =
 {
-    sleep_on_init on_init;
-    sleep_on_enter on_enter;
-    sleep_on_exit on_exit;
+    SLEEP_IDLE_CURRENT_NA,
+    SLEEP_STANDBY_CURRENT_NA,
+    SLEEP_POWER_DOWN_CURRENT_NA
 };
 
-/** Library doesn't allow for peripherals de-registration so, we can
- ** just use an array and an index to the first invalid element to store
- ** the handlers of registered devices.
+/** Residency statistics for each sleep_mode_t */
+static struct sleep_mode_stats mode_stats[SLEEP_MODES];
+
+/** Charge drawn in each sleep_mode_t and awake (up to the last sleep),
+ ** in ticks * nA. Accumulated per stretch so that it doesn't wrap with
+ ** residency_ticks: 64 bits last for decades at SLEEP_ACTIVE_CURRENT_NA.
  **/
-static struct sleep_config_handlers peripheral_handlers[SLEEP_MAX_REGISTERED_PERIPHERALS];
-static uint8_t peripheral_handlers_first_invalid = 0;
+static uint64_t mode_charge[SLEEP_MODES];
+static uint64_t active_charge;
+
+/** Time spent awake, up to the last sleep. */
+static uint32_t active_ticks;
+/** Tick of the last wake-up (or of sleep_init). */
+static uint32_t last_wakeup_tick;
+/** Wake-ups per source and last source. */
+static uint32_t wakeups[SLEEP_WAKEUP_SOURCES];
+static uint8_t last_wakeup;
+/** Cost of the handlers. */
+static struct sleep_handlers_cost enter_handlers_cost;
+static struct sleep_handlers_cost exit_handlers_cost;
+
+volatile uint8_t sleep_wakeup_first = SLEEP_WAKEUP_UNKNOWN;
 
-/** Run "on_init" handlers of all the registered peripherals
+/** Run "on_init" handlers of all the listed peripherals
  **/
-static void run_init_handlers(void)
+static inline void run_init_handlers(void)
 {
-    uint8_t i;
-    struct sleep_config_handlers *ph;
+    SLEEP_ON_INIT_HANDLERS
+}
+
+/** Run "on_enter" handlers of all the listed peripherals
+ **/
+static inline void run_enter_handlers(void)
+{
+    SLEEP_ON_ENTER_HANDLERS
+}
+
+/** Run "on_exit" handlers of all the listed peripherals
+ **/
+static inline void run_exit_handlers(void)
+{
+    SLEEP_ON_EXIT_HANDLERS
+}
 
-    for(i = 0; i < peripheral_handlers_first_invalid; i++)
+void sleep_init(void)
+{
+    run_init_handlers();
+    last_wakeup_tick = timer_get_tick();
+}
+
+/** Update the cost of a set of handlers, started at "start" cycle
+ ** counter value.
+ **/
+static void update_handlers_cost(struct sleep_handlers_cost *cost, uint16_t start)
+{
+    uint16_t counts;
+
+    counts = (uint16_t)(SLEEP_CYCLE_COUNTER() + SLEEP_CYCLE_COUNTER_PERIOD - start) %
+             SLEEP_CYCLE_COUNTER_PERIOD;
+    cost->last_cycles = counts * SLEEP_CYCLES_PER_COUNT;
+    if(cost->last_cycles > cost->max_cycles)
     {
-        ph = &peripheral_handlers[i];
-        if(ph->on_init != NULL)
-        {
-            (*ph->on_init)();
-        }
+        cost->max_cycles = cost->last_cycles;
     }
 }
 
-/** Run "on_enter" handlers of all the registered peripherals
+/** Convert a charge in ticks * nA to uC */
+static uint64_t charge_uc(uint64_t charge)
+{
+    return charge / (TIMER_TICKS_PER_SEC * 1000UL);
+}
+
+/** Enter a low power mode and update its statistics.
+ ** Called with interrupts disabled; interrupts are enabled on return.
  **/
-static void run_enter_handlers(void)
+static void sleep_enter_mode(sleep_mode_t mode)
 {
-    uint8_t i;
-    struct sleep_config_handlers *ph;
+    struct sleep_mode_stats *st = &mode_stats[mode];
+    uint32_t start;
+    uint16_t cycles;
+    uint8_t source;
 
-    for(i = 0; i < peripheral_handlers_first_invalid; i++)
+    set_sleep_mode(sleep_mode_hw[mode]);
+    if(mode != sleep_mode_idle)
     {
-        ph = &peripheral_handlers[i];
-        if(ph->on_enter != NULL)
-        {
-            (*ph->on_enter)();
-        }
+        cycles = SLEEP_CYCLE_COUNTER();
+        run_enter_handlers();
+        update_handlers_cost(&enter_handlers_cost, cycles);
+    }
+    st->enter_count++;
+    start = timer_get_tick();
+    active_ticks += start - last_wakeup_tick;
+    active_charge += (uint64_t)(start - last_wakeup_tick) * SLEEP_ACTIVE_CURRENT_NA;
+    /* Arm wake-up attribution: first sleep_note_wakeup wins. */
+    sleep_wakeup_first = SLEEP_WAKEUP_SOURCES;
+    sleep_enable();
+    /* SEI executes the next instruction before any pending interrupt:
+     * we can't miss a wake-up between here and sleep_cpu. */
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    /* Wake-up ISR has run, statistics are only touched here so no
+     * need to protect them. */
+    cli();
+    source = sleep_wakeup_first;
+    if(source >= SLEEP_WAKEUP_SOURCES)
+    {
+        source = SLEEP_WAKEUP_UNKNOWN;
+    }
+    sleep_wakeup_first = source;
+    sei();
+    last_wakeup = source;
+    wakeups[source]++;
+    last_wakeup_tick = timer_get_tick();
+    st->residency_ticks += last_wakeup_tick - start;
+    mode_charge[mode] += (uint64_t)(last_wakeup_tick - start) * sleep_current_na[mode];
+    st->exit_count++;
+    if(mode != sleep_mode_idle)
+    {
+        cycles = SLEEP_CYCLE_COUNTER();
+        run_exit_handlers();
+        update_handlers_cost(&exit_handlers_cost, cycles);
     }
 }
-/** Run "on_exit" handlers of all the registered peripherals
- **/
-static void run_exit_handlers(void)
+
+void sleep_constraint_set(sleep_mode_t deepest)
 {
-    uint8_t i;
-    struct sleep_config_handlers *ph;
+    interrupts_state_t sreg;
+
+    if(deepest >= SLEEP_MODES)
+    {
+        return;
+    }
+    sreg = interrupts_save_off();
+    constraints[deepest]++;
+    interrupts_restore(sreg);
+}
+
+void sleep_constraint_release(sleep_mode_t deepest)
+{
+    interrupts_state_t sreg;
 
-    for(i = 0; i < peripheral_handlers_first_invalid; i++)
+    if(deepest >= SLEEP_MODES)
+    {
+        return;
+    }
+    sreg = interrupts_save_off();
+    if(constraints[deepest] > 0)
     {
-        ph = &peripheral_handlers[i];
-        if(ph->on_exit != NULL)
+        constraints[deepest]--;
+    }
+    interrupts_restore(sreg);
+}
+
+sleep_mode_t sleep_select_mode(uint32_t deadline)
+{
+    uint8_t mode;
+
+    /* Shallowest constrained mode limits how deep we can go */
+    for(mode = sleep_mode_idle; mode < (SLEEP_MODES - 1); mode++)
+    {
+        if(constraints[mode] != 0)
         {
-            (*ph->on_exit)();
+            break;
         }
     }
+#if SLEEP_POWER_DOWN_STOPS_TIMER
+    if((deadline != SLEEP_NO_DEADLINE) && (mode == sleep_mode_power_down))
+    {
+        mode = sleep_mode_standby;
+    }
+#endif
+    /* Back off until the mode is worth entering before the deadline */
+    while((mode > sleep_mode_idle) && (deadline < sleep_min_residency[mode]))
+    {
+        mode--;
+    }
+    return (sleep_mode_t)mode;
 }
 
-void sleep_init(void)
+sleep_mode_t sleep_auto(void)
 {
-    run_init_handlers();
+    sleep_mode_t mode;
+
+    /* Don't let an interrupt add a constraint or start a timer
+     * between selecting the mode and entering it. */
+    cli();
+    mode = sleep_select_mode(timer_next_deadline());
+    sleep_enter_mode(mode);
+    return mode;
 }
 
-bool sleep_register_peripheral(sleep_on_init on_init_hlr,
-                               sleep_on_enter on_enter_hlr,
-                               sleep_on_exit on_exit_hlr)
+bool sleep_get_stats(sleep_mode_t mode, struct sleep_mode_stats *stats)
 {
-    struct sleep_config_handlers *ph;
+    uint64_t charge;
+    interrupts_state_t sreg;
 
-    if(peripheral_handlers_first_invalid >= SLEEP_MAX_REGISTERED_PERIPHERALS)
+    if((mode >= SLEEP_MODES) || (stats == NULL))
     {
-        /* No more slots to register a peripheral */
         return false;
     }
+    sreg = interrupts_save_off();
+    *stats = mode_stats[mode];
+    charge = mode_charge[mode];
+    interrupts_restore(sreg);
+    stats->charge_uc = charge_uc(charge);
+    return true;
+}
 
-    /* Select first available slot */
-    ph = &peripheral_handlers[peripheral_handlers_first_invalid];
-    /* Store the handlers (not NULL is allowed) */
-    ph->on_init = on_init_hlr;
-    ph->on_enter = on_enter_hlr;
-    ph->on_exit = on_exit_hlr;
-    /* Move to the next slot. */
-    peripheral_handlers_first_invalid++;
+void sleep_get_telemetry(struct sleep_telemetry *tlm)
+{
+    uint8_t i;
+    uint32_t awake;
+    uint64_t charge;
+    interrupts_state_t sreg;
 
-    return true;
+    for(i = 0; i < SLEEP_MODES; i++)
+    {
+        sleep_get_stats((sleep_mode_t)i, &tlm->modes[i]);
+    }
+    sreg = interrupts_save_off();
+    /* Include the current stretch of activity. */
+    awake = timer_get_tick() - last_wakeup_tick;
+    tlm->active_ticks = active_ticks + awake;
+    charge = active_charge + (uint64_t)awake * SLEEP_ACTIVE_CURRENT_NA;
+    for(i = 0; i < SLEEP_WAKEUP_SOURCES; i++)
+    {
+        tlm->wakeups[i] = wakeups[i];
+    }
+    tlm->last_wakeup = last_wakeup;
+    tlm->enter_handlers = enter_handlers_cost;
+    tlm->exit_handlers = exit_handlers_cost;
+    interrupts_restore(sreg);
+    tlm->active_charge_uc = charge_uc(charge);
 }
 
-/** Implementation will mainly wrap macros
- ** that AVR libc provides us to make our life easier
+/** Both legacy modes go through the power manager so that
+ ** their residency is accounted too.
  **/
 void sleep_on_the_couch(void)
 {
-    /* Set sleep mode register */
-    set_sleep_mode(SLEEP_MODE_IDLE);
-    /* Set sleep enable bit. */
-    sleep_enable();
-    /* Call asm("SLEEP") to actually enter sleep. zzzz!*/
-    sleep_cpu();
-    /* Here we are out of sleep!! Reset sleep enable bit. */
-    sleep_disable();
+    cli();
+    sleep_enter_mode(sleep_mode_idle);
 }
 
-/** Implementation will mainly wrap macros
- ** that AVR libc provides us to make our life easier
- **/
 void sleep_on_the_bed(void)
 {
-    /* Set sleep mode register */
-    set_sleep_mode(SLEEP_MODE_STANDBY);
-    /* Set sleep enable bit and run enter handlers. */
-    run_enter_handlers();
-    sleep_enable();
-    /* Call asm("SLEEP") to actually enter sleep. ZZZZ!!*/
-    sleep_cpu();
-    /* Here we are out of sleep!!
-     * Reset sleep enable bit and call exit handlers. */
-    sleep_disable();
-    run_exit_handlers();
+    cli();
+    sleep_enter_mode(sleep_mode_standby);
 }
 /****************************************************************/
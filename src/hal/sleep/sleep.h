@@ -9,10 +9,14 @@
 **                              Peripherals (or most of them) are still active.
 **        - sleep_on_the_bed: hard low power mode. Both CPU and (most of)
 **                            peripherals are switched off. Peripherals meant
-**                            to be active during sleep, need to register themselves
-**                            to the sleep module to allow their self-configuration.
+**                            to be active during sleep, need to be listed in
+**                            sleep_config.h to allow their self-configuration.
 **                            (i.e. enable them selves during sleep, switch to a
 **                            lower power clock source).
+**
+**         On top of that, a power manager picks the mode automatically
+**         (sleep_auto) from the constraints declared by drivers and from the
+**         next wake-up deadline, and keeps residency statistics per mode.
 **/
 /****************************************************************/
 #ifndef __SLEEP_H
@@ -26,74 +30,38 @@ extern "C" {
 #include <stdbool.h>
 /****************************************************************/
 
-/*!    \brief Type for on-init handler for peripherals.
-**
-** Self-configuration handler that peripherals should provide during
-** registration.
-**
-** It will be called during sleep_init().
-**
-** It can be used for one-off configurations, i.e. to allow
-** the device to be always active during sleep.
-**/
-typedef void (*sleep_on_init)(void);
-
-/*!    \brief Type for on-enter handler for peripherals.
-**
-** Self-configuration handler that peripherals should provide during
-** registration.
-**
-** It will be called before entering sleep_on_bed mode.
-**
-** It can be used i.e. to switch clock source before going into
-** hard sleep states.
-**/
-typedef void (*sleep_on_enter)(void);
-
-/*!    \brief Type for on-exit handler for peripherals.
-**
-** Self-configuration handler that peripherals should provide during
-** registration.
-**
-** It will be called just after leaving sleep_on_bed mode.
-**
-** It can be used to restore the settings altered by sleep_on_enter.
-**/
-typedef void (*sleep_on_exit)(void);
-
 /*!    \brief One-off initialisation for sleep module.
 **
-** Initialise the sleep hardware and call sleep_on_init function for
-** all the registered peripherals.
+** Initialise the sleep hardware and call the on-init handlers of
+** all the peripherals listed in sleep_config.h.
 **
 ** NOTE: This function shall be called after all the required peripherals
-** have been initialised and registered.
+** have been initialised.
 **
 **    \return None
 **/
 void sleep_init(void);
 
-/*!    \brief Register a device for sleep self-configuration.
+/*!    \brief Peripherals' sleep handlers.
 **
-** This function decouples the sleep module from the configuration
-** of each peripherals for sleep_on_bed() mode. Each peripheral,
-** intended to be active during sleep (i.e. as a wake-up source),
-** will need to register a set of handlers to allow its in/out of
-** sleep configuration.
-** Even though sleep is typically a system (global) level feature,
-** this should make it easier to configure individual hardware
-** modules with a discrete level of independence.
+** This decouples the sleep module from the configuration of each
+** peripheral for sleep_on_bed() mode. Each peripheral, intended to be
+** active during sleep (i.e. as a wake-up source), provides a set of
+** "void handler(void)" functions for its in/out of sleep configuration:
+** - on-init: called during sleep_init(). It can be used for one-off
+**            configurations, i.e. to allow the device to be always
+**            active during sleep.
+** - on-enter: called before entering sleep_on_bed() mode. It can be used
+**             i.e. to switch clock source before going into hard sleep
+**             states.
+** - on-exit: called just after leaving sleep_on_bed() mode. It can be used
+**            to restore the settings altered by the on-enter handler.
 **
-**    \param [in] on_init_hlr   - handler to call during sleep_init()
-**    \param [in] sleep_on_enter - handler to call before entering sleep_to_bed() mode.
-**    \param [in] sleep_on_exit - handler to call just after exit from sleep_to_bed()
-**                                mode.
-**
-**    \return true if registration succeeded.
+** Handlers are listed at build time in sleep_config.h
+** (SLEEP_ON_INIT_HANDLERS, SLEEP_ON_ENTER_HANDLERS, SLEEP_ON_EXIT_HANDLERS)
+** and called directly: there is no limit to their number, they don't
+** use RAM and there is no registration at runtime.
 **/
-bool sleep_register_peripheral(sleep_on_init on_init_hlr,
-                               sleep_on_enter on_enter_hlr,
-                               sleep_on_exit on_exit_hlr);
 
 /*!    \brief Enter soft low power mode where only CPU is off.
 **
@@ -123,6 +91,186 @@ void sleep_on_the_couch(void);
 **    \return None.
 **/
 void sleep_on_the_bed(void);
+
+/*!    \brief Low power modes known to the power manager.
+**
+** Modes are sorted from the shallowest to the deepest one:
+** - sleep_mode_idle: only the CPU is halted (same as sleep_on_the_couch).
+** - sleep_mode_standby: most peripherals are off, peripherals configured to
+**                       run in standby (i.e. RTC) are still active (same as
+**                       sleep_on_the_bed).
+** - sleep_mode_power_down: only the PIT and pin change interrupts can wake up
+**                          the device. RTC counter is stopped.
+**/
+typedef enum
+{
+    sleep_mode_idle = 0,
+    sleep_mode_standby,
+    sleep_mode_power_down,
+    SLEEP_MODES
+} sleep_mode_t;
+
+/*!    \brief No wake-up deadline.
+**
+** Use with sleep_select_mode when there is no timed wake-up pending.
+** Same value as TIMER_NO_DEADLINE.
+**/
+#define SLEEP_NO_DEADLINE 0xFFFFFFFFUL
+
+/*!    \brief Residency statistics for a low power mode.
+**
+** Residency is in ticks of the system timer (timer_get_tick()).
+** RTC counter is stopped in power down: residency for that mode
+** only accounts for the ticks seen around entry/exit. Residency
+** wraps at 2^32 ticks, charge is accumulated on 64 bits and doesn't.
+**/
+struct sleep_mode_stats
+{
+    uint32_t enter_count;    /**< Number of times the mode was entered. */
+    uint32_t exit_count;     /**< Number of times the device woke up from the mode. */
+    uint32_t residency_ticks;/**< Total time spent in the mode. */
+    uint64_t charge_uc;      /**< Estimated charge drawn in the mode, in uC. */
+};
+
+/*!    \brief Wake-up sources.
+**
+** Identifiers for the interrupt that woke the device up (see
+** sleep_note_wakeup). Application defined sources start from
+** SLEEP_WAKEUP_USER and shall be lower than SLEEP_WAKEUP_SOURCES.
+**/
+#define SLEEP_WAKEUP_UNKNOWN 0 /**< Interrupt not instrumented. */
+#define SLEEP_WAKEUP_RTC     1 /**< System timer (RTC counter). */
+#define SLEEP_WAKEUP_PIT     2 /**< Periodic tick (RTC PIT). */
+#define SLEEP_WAKEUP_CAPTURE 3 /**< Input capture. */
+#define SLEEP_WAKEUP_USER    4 /**< First application defined source. */
+#define SLEEP_WAKEUP_SOURCES 8
+
+/*!    \brief Cost of the on-enter/on-exit handlers in cpu cycles.
+**/
+struct sleep_handlers_cost
+{
+    uint16_t last_cycles; /**< Cost for the last sleep. */
+    uint16_t max_cycles;  /**< Worst cost seen. */
+};
+
+/*!    \brief Sleep telemetry.
+**
+** Snapshot of the sleep instrumentation. Times are in ticks of
+** the system timer (timer_get_tick(), TIMER_TICKS_PER_SEC per second),
+** charges are estimated from the per-mode current figures in
+** sleep_config.h.
+**/
+struct sleep_telemetry
+{
+    struct sleep_mode_stats modes[SLEEP_MODES]; /**< Statistics per mode. */
+    uint32_t active_ticks;      /**< Time spent awake since sleep_init. */
+    uint64_t active_charge_uc;  /**< Estimated charge drawn awake, in uC. */
+    uint32_t wakeups[SLEEP_WAKEUP_SOURCES]; /**< Wake-ups per source. */
+    uint8_t last_wakeup;        /**< Source of the last wake-up. */
+    struct sleep_handlers_cost enter_handlers; /**< on-enter handlers cost. */
+    struct sleep_handlers_cost exit_handlers;  /**< on-exit handlers cost. */
+};
+
+/*!    \brief Attribute the wake-up to an interrupt source.
+**
+** Call at the beginning of an interrupt handler that can wake up the
+** device. Only the first interrupt after entering sleep is recorded,
+** later calls are ignored until the next sleep.
+** Interrupts that don't call it are counted as SLEEP_WAKEUP_UNKNOWN.
+**
+**    \param [in] source - SLEEP_WAKEUP_* identifier of the interrupt.
+**/
+#define sleep_note_wakeup(source) \
+    do \
+    { \
+        if(sleep_wakeup_first == SLEEP_WAKEUP_SOURCES) \
+        { \
+            sleep_wakeup_first = (source); \
+        } \
+    } while(0)
+
+/*!    \brief First wake-up source since entering sleep.
+**
+** Private to sleep_note_wakeup: equal to SLEEP_WAKEUP_SOURCES while
+** waiting for the wake-up interrupt.
+**/
+extern volatile uint8_t sleep_wakeup_first;
+
+/*!    \brief Declare a sleep constraint.
+**
+** Drivers call this function to prevent the power manager from
+** entering a mode deeper than "deepest" while they are busy
+** (i.e. UART receiving -> sleep_mode_idle, ADC converting ->
+** sleep_mode_standby).
+** Constraints are counted: each call shall be balanced by a call to
+** sleep_constraint_release with the same mode.
+** Safe to call from interrupt context.
+**
+**    \param [in] deepest - deepest mode allowed while the constraint holds.
+**
+**    \return None.
+**/
+void sleep_constraint_set(sleep_mode_t deepest);
+
+/*!    \brief Release a sleep constraint.
+**
+** Release a constraint previously declared with sleep_constraint_set.
+** Safe to call from interrupt context.
+**
+**    \param [in] deepest - same mode passed to sleep_constraint_set.
+**
+**    \return None.
+**/
+void sleep_constraint_release(sleep_mode_t deepest);
+
+/*!    \brief Select the deepest allowed low power mode.
+**
+** The mode is the deepest one allowed by all the active constraints
+** that is also worth entering before the next wake-up deadline:
+** each mode has a minimum residency (see sleep_config.h) accounting
+** for its wake-up latency and for the on-enter/on-exit handlers.
+** Modes that stop the system timer are not selected if a deadline
+** is pending.
+**
+**    \param [in] deadline - ticks (timer_get_tick()) until the next timed
+**                           wake-up, SLEEP_NO_DEADLINE if none.
+**
+**    \return Selected mode.
+**/
+sleep_mode_t sleep_select_mode(uint32_t deadline);
+
+/*!    \brief Enter the deepest allowed low power mode.
+**
+** Select the mode as sleep_select_mode does for the next timer expiry
+** (timer_next_deadline()) and enter it. On-enter and on-exit handlers
+** are called for modes deeper than sleep_mode_idle.
+** Mode selection and sleep entry are atomic: a constraint set or a
+** timer started by an interrupt just before sleeping is honoured.
+** Interrupts are enabled on return.
+**
+**    \return Mode the device woke up from.
+**/
+sleep_mode_t sleep_auto(void);
+
+/*!    \brief Get residency statistics for a low power mode.
+**
+**    \param [in] mode   - low power mode.
+**    \param [out] stats - statistics for the mode.
+**
+**    \return false if mode is not valid.
+**/
+bool sleep_get_stats(sleep_mode_t mode, struct sleep_mode_stats *stats);
+
+/*!    \brief Get a snapshot of the sleep instrumentation.
+**
+** Meant for telemetry: residency, estimated charge and wake-up sources
+** for all modes, plus the cost of the sleep handlers.
+**
+**    \param [out] tlm - telemetry snapshot.
+**
+**    \return None.
+**/
+void sleep_get_telemetry(struct sleep_telemetry *tlm);
 /****************************************************************/
 #ifdef __cplusplus
 }
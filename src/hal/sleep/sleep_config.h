@@ -17,12 +17,76 @@ extern "C" {
 #include <stdbool.h>
 /****************************************************************/
 
-/*!    \brief Maximum number of registered peripherals
+/*!    \brief Current figures for the charge model
 **
-** This is the maximum number of peripherals that can be registered
-** using sleep_register_peripheral(...) API.
+** Average supply current in nA for each mode, from the data-sheet or,
+** better, measured on the board. Used to estimate the charge drawn
+** in each mode from its residency.
 **/
-#define SLEEP_MAX_REGISTERED_PERIPHERALS 4
+#define SLEEP_ACTIVE_CURRENT_NA     6400000UL /* 16MHz @5V */
+#define SLEEP_IDLE_CURRENT_NA       2500000UL /* 16MHz @5V */
+#define SLEEP_STANDBY_CURRENT_NA    700UL     /* RTC running */
+#define SLEEP_POWER_DOWN_CURRENT_NA 100UL     /* PIT running */
+
+/*!    \brief Cycle counter for handlers cost
+**
+** Free running counter used to measure the cost of on-enter/on-exit
+** handlers. Defaults to the counter of the millis() timer (TCB3 clocked
+** by TCA0 at F_CPU/64, wraps at 256): handlers are expected to take
+** less than 1ms.
+**/
+#define SLEEP_CYCLE_COUNTER() (TCB3.CNT)
+#define SLEEP_CYCLE_COUNTER_PERIOD 256U
+#define SLEEP_CYCLES_PER_COUNT 64U
+
+/*!    \brief Peripherals' on-init handlers
+**
+** List of SLEEP_HANDLER(function) entries. Functions are
+** "void function(void)" provided by the peripheral drivers (see sleep.h)
+** and are called in list order by sleep_init().
+**/
+#define SLEEP_ON_INIT_HANDLERS \
+    SLEEP_HANDLER(timer_sleep_on_init) \
+    SLEEP_HANDLER(pit_sleep_on_init)
+
+/*!    \brief Peripherals' on-enter handlers
+**
+** Same as SLEEP_ON_INIT_HANDLERS. Called in list order before entering
+** modes deeper than idle.
+**/
+#define SLEEP_ON_ENTER_HANDLERS \
+    SLEEP_HANDLER(timer_sleep_on_enter)
+
+/*!    \brief Peripherals' on-exit handlers
+**
+** Same as SLEEP_ON_INIT_HANDLERS. Called in list order after exiting
+** modes deeper than idle.
+**/
+#define SLEEP_ON_EXIT_HANDLERS \
+    SLEEP_HANDLER(timer_sleep_on_exit)
+
+/*!    \brief Minimum residency for standby mode
+**
+** sleep_auto will not enter standby if the next wake-up deadline is
+** closer than this, in system timer ticks (timer_get_tick()).
+** It shall cover wake-up latency and on-enter/on-exit handlers
+** (i.e. timer flushing RTC registers takes up to one RTC synchronisation).
+**/
+#define SLEEP_STANDBY_MIN_RESIDENCY_TICKS 2
+
+/*!    \brief Minimum residency for power down mode
+**
+** sleep_auto will not enter power down if the next wake-up deadline is
+** closer than this, in system timer ticks (timer_get_tick()).
+**/
+#define SLEEP_POWER_DOWN_MIN_RESIDENCY_TICKS 8
+
+/*!    \brief Power down stops the system timer.
+**
+** RTC counter doesn't run in power down, so a timed wake-up can't
+** happen from it. Define to 0 if the system timer runs from the PIT.
+**/
+#define SLEEP_POWER_DOWN_STOPS_TIMER 1
 
 /****************************************************************/
 #ifdef __cplusplus
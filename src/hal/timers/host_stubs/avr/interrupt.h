@@ -0,0 +1,26 @@
+/*!\file interrupt.h
+** \author
+** \copyright
+** \brief Host stub for <avr/interrupt.h> used by timer unit tests.
+** \details ISRs become plain functions that tests can call.
+**
+**          IT NEEDS ONLY TO BE INCLUDED IN HOST TESTS.
+**/
+/****************************************************************/
+#ifndef __TIMER_HOST_AVR_INTERRUPT_H
+#define __TIMER_HOST_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define cli() (SREG &= ~0x80)
+#define sei() (SREG |= 0x80)
+
+/** Vector names expand to the function a test calls to
+ ** "fire" the interrupt.
+ **/
+#define RTC_CNT_vect rtc_cnt_vect_host
+#define ISR(vector) void vector(void)
+
+void rtc_cnt_vect_host(void);
+
+#endif /* __TIMER_HOST_AVR_INTERRUPT_H */
@@ -0,0 +1,148 @@
+/*!\file io.h
+** \author
+** \copyright
+** \brief Host stub for <avr/io.h> used by timer unit tests.
+** \details Minimal "simulation" of the RTC registers used by timer.c
+**          so that it can be built and run on the host pc.
+**
+**          Registers living in the RTC clock domain (CTRLA, PER, CMP)
+**          are busy for RTC_SIM_SYNC_CYCLES cpu cycles after each write.
+**          Each read of RTC.STATUS costs RTC_SIM_POLL_CYCLES cpu cycles:
+**          counting reads gives the time the cpu spent stalled
+**          waiting for the RTC to synchronise.
+**
+**          IT NEEDS ONLY TO BE INCLUDED IN HOST TESTS.
+**/
+/****************************************************************/
+#ifndef __TIMER_HOST_AVR_IO_H
+#define __TIMER_HOST_AVR_IO_H
+
+#include <stdint.h>
+
+/** Cpu cycles of a RTC register synchronisation: 2 RTC cycles @32768Hz
+ ** with the cpu running @16MHz.
+ **/
+#define RTC_SIM_SYNC_CYCLES 977
+
+/** Cpu cycles spent by each RTC.STATUS read (load, test and branch). */
+#define RTC_SIM_POLL_CYCLES 4
+
+/** Simulated cpu clock. Shall be advanced by the test to let time pass. */
+extern uint64_t rtc_sim_cycles;
+
+/** Number of RTC.STATUS reads since start of the test. */
+extern uint32_t rtc_sim_status_reads;
+
+/** Number of writes to a RTC register while it was still synchronising. */
+extern uint32_t rtc_sim_busy_writes;
+
+/*!    \brief Register synchronised to the RTC clock domain.
+**/
+template<typename T, uint8_t busy_bm>
+class RtcSyncRegister
+{
+public:
+    RtcSyncRegister& operator=(T v)
+    {
+        if(rtc_sim_cycles < busyUntil)
+        {
+            rtc_sim_busy_writes++;
+        }
+        value = v;
+        busyUntil = rtc_sim_cycles + RTC_SIM_SYNC_CYCLES;
+        return *this;
+    }
+    operator T() const { return value; }
+    uint8_t busy(void) const { return rtc_sim_cycles < busyUntil ? busy_bm : 0; }
+private:
+    T value = 0;
+    uint64_t busyUntil = 0;
+};
+
+/*!    \brief Interrupt flags register: write one to clear.
+**/
+class RtcFlagsRegister
+{
+public:
+    RtcFlagsRegister& operator=(uint8_t v) { value &= ~v; return *this; }
+    RtcFlagsRegister& operator&=(uint8_t v) { value &= ~v; return *this; }
+    operator uint8_t() const { return value; }
+    uint8_t value = 0;
+};
+
+struct RTC_t;
+
+/*!    \brief Status register: busy flags of the synchronised registers.
+**/
+class RtcStatusRegister
+{
+public:
+    operator uint8_t() const;
+};
+
+typedef enum
+{
+    RTC_PRESCALER_DIV1_gc = (0x00<<3),
+    RTC_PRESCALER_DIV2_gc = (0x01<<3),
+    RTC_PRESCALER_DIV4_gc = (0x02<<3),
+    RTC_PRESCALER_DIV8_gc = (0x03<<3),
+    RTC_PRESCALER_DIV16_gc = (0x04<<3),
+    RTC_PRESCALER_DIV32_gc = (0x05<<3),
+    RTC_PRESCALER_DIV64_gc = (0x06<<3),
+    RTC_PRESCALER_DIV128_gc = (0x07<<3),
+    RTC_PRESCALER_DIV256_gc = (0x08<<3),
+    RTC_PRESCALER_DIV512_gc = (0x09<<3),
+    RTC_PRESCALER_DIV1024_gc = (0x0A<<3),
+    RTC_PRESCALER_DIV2048_gc = (0x0B<<3),
+    RTC_PRESCALER_DIV4096_gc = (0x0C<<3),
+    RTC_PRESCALER_DIV8192_gc = (0x0D<<3),
+    RTC_PRESCALER_DIV16384_gc = (0x0E<<3),
+    RTC_PRESCALER_DIV32768_gc = (0x0F<<3),
+} RTC_PRESCALER_t;
+
+#define RTC_RTCEN_bm         0x01
+#define RTC_RUNSTDBY_bm      0x80
+#define RTC_OVF_bm           0x01
+#define RTC_CMP_bm           0x02
+#define RTC_CTRLABUSY_bm     0x01
+#define RTC_CNTBUSY_bm       0x02
+#define RTC_PERBUSY_bm       0x04
+#define RTC_CMPBUSY_bm       0x08
+#define RTC_CLKSEL_INT32K_gc 0x00
+#define RTC_CLKSEL_TOSC32K_gc 0x02
+
+struct RTC_t
+{
+    RtcSyncRegister<uint8_t, RTC_CTRLABUSY_bm> CTRLA;
+    RtcStatusRegister STATUS;
+    uint8_t INTCTRL;
+    RtcFlagsRegister INTFLAGS;
+    uint8_t CLKSEL;
+    uint16_t CNT;
+    RtcSyncRegister<uint16_t, RTC_PERBUSY_bm> PER;
+    RtcSyncRegister<uint16_t, RTC_CMPBUSY_bm> CMP;
+};
+
+extern RTC_t RTC;
+
+inline RtcStatusRegister::operator uint8_t() const
+{
+    rtc_sim_cycles += RTC_SIM_POLL_CYCLES;
+    rtc_sim_status_reads++;
+    return RTC.CTRLA.busy() | RTC.PER.busy() | RTC.CMP.busy();
+}
+
+struct CLKCTRL_t
+{
+    uint8_t XOSC32KCTRLA;
+};
+
+extern CLKCTRL_t CLKCTRL;
+
+#define CLKCTRL_ENABLE_bm 0x01
+#define _PROTECTED_WRITE(reg, value) ((reg) = (value))
+
+/** Status register: only the global interrupt flag is of interest. */
+extern uint8_t SREG;
+
+#endif /* __TIMER_HOST_AVR_IO_H */
@@ -0,0 +1,114 @@
+/*!\file pit.c
+** \author
+** \copyright
+** \brief Implementation of the periodic tick on the RTC PIT.
+** \details
+**/
+/****************************************************************/
+
+#include "pit.h"
+#include "pit_config.h"
+#include "interrupts.h"
+#include "isr_profile.h"
+#include "sleep.h"
+#include <stddef.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+/****************************************************************/
+
+struct pit_subscriber
+{
+    pit_callback_t callback; /** Callback to execute. */
+    uint16_t reload;         /** Ticks between two executions. */
+    uint16_t countdown;      /** Ticks left to the next execution. */
+};
+
+/** Library doesn't allow for unsubscribing so, we can just use an array
+ ** and an index to the first invalid element to store the subscribers.
+ **/
+static volatile struct pit_subscriber subscribers[PIT_MAX_SUBSCRIBERS];
+static volatile uint8_t subscribers_first_invalid = 0;
+
+/** Heartbeat periods elapsed since start. */
+static volatile uint32_t pit_ticks;
+
+/*!    \brief Start the heartbeat.
+**
+** On-init handler listed in sleep_config.h: the PIT keeps
+** running in all sleep modes, so nothing needs to be done on
+** enter/exit. Starting it from sleep_init ensures it only runs
+** once the system is fully initialised.
+**
+**    \return Nothing.
+**/
+void pit_sleep_on_init(void)
+{
+    /* From data-sheet: always check the Busy bits in the RTC.PITSTATUS
+     * also on initial configuration.
+     */
+    while(RTC.PITSTATUS & RTC_CTRLBUSY_bm);
+    RTC.PITINTCTRL = RTC_PI_bm;
+    RTC.PITCTRLA = PIT_PERIOD | RTC_PITEN_bm;
+}
+
+ISR(RTC_PIT_vect)
+{
+    ISR_PROFILE_SCOPE(isr_profile_rtc_pit);
+    uint8_t i;
+    volatile struct pit_subscriber *s;
+
+    sleep_note_wakeup(SLEEP_WAKEUP_PIT);
+    /* Acknowledge interrupt */
+    RTC.PITINTFLAGS = RTC_PI_bm;
+    pit_ticks++;
+    for(i = 0; i < subscribers_first_invalid; i++)
+    {
+        s = &subscribers[i];
+        if(--s->countdown == 0)
+        {
+            s->countdown = s->reload;
+            (*s->callback)();
+        }
+    }
+}
+
+void pit_init(void)
+{
+    pit_ticks = 0;
+}
+
+bool pit_subscribe(pit_callback_t clbk, uint16_t ticks)
+{
+    volatile struct pit_subscriber *s;
+    bool res = false;
+    interrupts_state_t sreg;
+
+    if((clbk == NULL) || (ticks == 0))
+    {
+        return false;
+    }
+    sreg = interrupts_save_off();
+    if(subscribers_first_invalid < PIT_MAX_SUBSCRIBERS)
+    {
+        s = &subscribers[subscribers_first_invalid];
+        s->callback = clbk;
+        s->reload = ticks;
+        s->countdown = ticks;
+        subscribers_first_invalid++;
+        res = true;
+    }
+    interrupts_restore(sreg);
+    return res;
+}
+
+uint32_t pit_get_ticks(void)
+{
+    uint32_t ticks;
+    interrupts_state_t sreg;
+
+    sreg = interrupts_save_off();
+    ticks = pit_ticks;
+    interrupts_restore(sreg);
+    return ticks;
+}
+/****************************************************************/
@@ -0,0 +1,69 @@
+/*!\file pit.h
+** \author
+** \copyright TODO
+** \brief Low power periodic tick API
+** \details Periodic tick service based on the RTC Periodic Interrupt Timer (PIT).
+**          It provides an always-on heartbeat that keeps running in every sleep
+**          mode (power-down included), independently from the system timer.
+**          Users subscribe a callback to be executed every N ticks of the
+**          heartbeat (i.e. 1Hz housekeeping, watchdog service).
+**/
+/****************************************************************/
+#ifndef __PIT_H
+#define __PIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+/****************************************************************/
+
+/*!    \brief Type for periodic tick callbacks.
+**
+** Callbacks are executed in interrupt context.
+**/
+typedef void (*pit_callback_t)(void);
+
+/*!    \brief Initialise periodic tick.
+**
+**    Call at boot, after timer_init() (which selects the RTC clock source)
+**    and before sleep_init(). The heartbeat is started by sleep_init().
+**
+**    \return None
+**/
+void pit_init(void);
+
+/*!    \brief Sleep on-init handler.
+**
+** Starts the heartbeat. To be listed in sleep_config.h,
+** not meant to be called by users.
+**/
+void pit_sleep_on_init(void);
+
+/*!    \brief Subscribe a callback to the periodic tick.
+**
+** Subscriptions can't be removed.
+**
+**    \param [in] clbk  - callback to execute.
+**    \param [in] ticks - execute the callback every "ticks" periods
+**                        of the heartbeat (see PIT_PERIOD in pit_config.h).
+**
+**    \return true if subscription succeeded.
+**/
+bool pit_subscribe(pit_callback_t clbk, uint16_t ticks);
+
+/*!    \brief Get number of heartbeat periods since start.
+**
+**    \return Number of ticks elapsed.
+**/
+uint32_t pit_get_ticks(void);
+
+/****************************************************************/
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PIT_H */
+/****************************************************************/
@@ -0,0 +1,47 @@
+/*!\file pit_config.h
+** \author
+** \copyright TODO
+** \brief Static configuration for periodic tick.
+** \details This is a private header that can be used to statically configure
+**          the megavr implementation of the driver.
+**/
+/****************************************************************/
+#ifndef __PIT_CONFIG_H
+#define __PIT_CONFIG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+/****************************************************************/
+
+/*!    \brief Heartbeat period.
+**
+** Period of the PIT in cycles of the RTC clock (32768Hz, see timer_config.h).
+** Can be any of the following labels (see RTC_PERIOD_t in avr/io.h):
+**
+** RTC_PERIOD_CYC4_gc => 4 cycles (122us)
+** RTC_PERIOD_CYC8_gc => 8 cycles (244us)
+** ...
+** RTC_PERIOD_CYC8192_gc => 8192 cycles (0.25s)
+** RTC_PERIOD_CYC16384_gc => 16384 cycles (0.5s)
+** RTC_PERIOD_CYC32768_gc => 32768 cycles (1s)
+**/
+#define PIT_PERIOD RTC_PERIOD_CYC32768_gc
+
+/*!    \brief Maximum number of subscribers
+**
+** This is the maximum number of callbacks that can be subscribed
+** using pit_subscribe(...) API.
+**/
+#define PIT_MAX_SUBSCRIBERS 4
+
+/****************************************************************/
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PIT_CONFIG_H */
+/****************************************************************/
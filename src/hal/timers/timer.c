@@ -9,6 +9,7 @@
 #include "timer.h"
 #include "timer_config.h"
 #include "interrupts.h"
+#include "isr_profile.h"
 #include "sleep.h"
 #include <stddef.h>
 #include <avr/interrupt.h>
@@ -24,6 +25,58 @@
  */
 #define TIMER_PRESCALER_MASK(div)  _TIMER_PRESCALER_MASK(div)
 #define _TIMER_PRESCALER_MASK(div)  RTC_PRESCALER_DIV##div##_gc
+
+#ifdef TIMER_FREE_RUNNING
+
+#ifdef TIMER_USE_LP_CLOCK_IN_SLEEP
+#error "TIMER_USE_LP_CLOCK_IN_SLEEP requires stopping the RTC: not supported with TIMER_FREE_RUNNING"
+#endif
+
+/* RTC runs with a single prescaler setting: ms, sec and min timers
+ * only differ in the way their argument is converted into ticks.
+ */
+#define TIMER_TICK_PRESCALER_MASK  TIMER_PRESCALER_MASK(TIMER_TICK_FREQ_DIV)
+
+/* Milliseconds in one 16-bit epoch of the counter: timer_get_ms adds it
+ * on each overflow, so it has to be a whole number.
+ */
+#if ((65536ULL * 1000 * TIMER_TICK_FREQ_DIV) % TIMER_OSC_FREQ_HZ) != 0
+#error "TIMER_TICK_FREQ_DIV must give a whole number of ms per counter overflow"
+#endif
+#define TIMER_EPOCH_MS             ((65536ULL * 1000 * TIMER_TICK_FREQ_DIV) / TIMER_OSC_FREQ_HZ)
+
+/* The largest minutes value (UINT16_MAX) must be convertible into
+ * uint32_t ticks.
+ */
+#if ((TIMER_OSC_FREQ_HZ / TIMER_TICK_FREQ_DIV) * 60 * 65535ULL) > 0xFFFFFFFFULL
+#error "TIMER_TICK_FREQ_DIV is too small to express the minutes timer range"
+#endif
+
+#define rtcTicksFromMilliseconds(ms) (((uint32_t)(ms) * TIMER_TICKS_PER_SEC)/1000)
+#define rtcTicksFromSeconds(sec) ((uint32_t)(sec) * TIMER_TICKS_PER_SEC)
+#define rtcTicksFromMinutes(min) ((uint32_t)(min) * 60 * TIMER_TICKS_PER_SEC)
+
+/* Deadlines are compared using the signed difference with the current
+ * tick: they can't be further than half the tick range in the future.
+ */
+#define TIMER_MAX_DELAY_TICKS      INT32_MAX
+
+/* Writes to RTC.CMP take up to 2 RTC clock cycles to be synchronised.
+ * A compare value closer than this to the current count may be missed.
+ */
+#define TIMER_MIN_LEAD_TICKS       3
+
+/* Prescaler is fixed in free running mode: any mask is ignored. */
+#define TIMER_MS_PRESCALER_MASK    TIMER_TICK_PRESCALER_MASK
+#define TIMER_SEC_PRESCALER_MASK   TIMER_TICK_PRESCALER_MASK
+#define TIMER_MIN_PRESCALER_MASK   TIMER_TICK_PRESCALER_MASK
+
+/*!    \brief Type for RTC ticks.
+**/
+typedef uint32_t timer_ticks_t;
+
+#else /* TIMER_FREE_RUNNING */
+
 #define TIMER_MS_PRESCALER_MASK    TIMER_PRESCALER_MASK(TIMER_MS_FREQ_DIV)
 #define TIMER_SEC_PRESCALER_MASK   TIMER_PRESCALER_MASK(TIMER_SEC_FREQ_DIV)
 #define TIMER_MIN_PRESCALER_MASK   TIMER_PRESCALER_MASK(TIMER_MIN_FREQ_DIV)
@@ -62,6 +115,380 @@
 #define MIN_TO_TICKS_INT ((uint32_t)(MIN_TO_TICKS * INT_CAST_MULTIPLIER))
 #define rtcTicksFromMinutes(min) (((min) * MIN_TO_TICKS_INT)/INT_CAST_MULTIPLIER)
 
+/*!    \brief Type for RTC ticks.
+**/
+typedef uint16_t timer_ticks_t;
+
+#endif /* TIMER_FREE_RUNNING */
+
+/* RTC.CTRLA, RTC.PER and RTC.CMP live in the RTC clock domain: writes take
+ * up to 2 RTC clock cycles (~60us) to be synchronised and new writes are
+ * not allowed until then (see RTC.STATUS busy flags).
+ *
+ * Instead of spinning on the busy flags, writes are made to a shadow copy and
+ * flagged as pending. Pending writes are committed as soon as the relevant
+ * busy flag is clear, from any following timer API call, from the RTC ISR,
+ * from timer_poll() or, at the latest, before entering sleep.
+ */
+
+/** Registers with a pending write. Same bit positions as RTC.STATUS busy flags. */
+static volatile uint8_t rtc_pending;
+
+/** Value to write into RTC.CTRLA: always reflects the intended setting. */
+static volatile uint8_t rtc_ctrla_shadow;
+
+/** Value to write into RTC.PER when RTC_PERBUSY_bm is pending. */
+static volatile uint16_t rtc_per_shadow;
+
+#ifdef TIMER_FREE_RUNNING
+static void timer_arm_compare(void);
+#endif
+
+/*!    \brief Commit pending RTC register writes.
+**
+** Shall be called with interrupts disabled. Never waits: registers
+** still synchronising are left pending.
+**
+**    \return Nothing.
+**/
+static void timer_sync_commit(void)
+{
+    uint8_t ready;
+
+    if(rtc_pending == 0)
+    {
+        return;
+    }
+    ready = rtc_pending & ~RTC.STATUS;
+    if(ready & RTC_PERBUSY_bm)
+    {
+        RTC.PER = rtc_per_shadow;
+        rtc_pending &= ~RTC_PERBUSY_bm;
+    }
+    /* Don't (re)enable the counter with a stale period. */
+    if((ready & RTC_CTRLABUSY_bm) && !(rtc_pending & RTC_PERBUSY_bm))
+    {
+        RTC.CTRLA = rtc_ctrla_shadow;
+        rtc_pending &= ~RTC_CTRLABUSY_bm;
+    }
+#ifdef TIMER_FREE_RUNNING
+    if(ready & RTC_CMPBUSY_bm)
+    {
+        /* Compare value is recomputed: deadline may have moved meanwhile. */
+        timer_arm_compare();
+    }
+#endif
+}
+
+/*!    \brief Write-behind RTC.CTRLA.
+**
+** Shall be called with interrupts disabled.
+**
+**    \param [in] ctrla - value for RTC.CTRLA.
+**
+**    \return Nothing.
+**/
+static void timer_sync_write_ctrla(uint8_t ctrla)
+{
+    rtc_ctrla_shadow = ctrla;
+    rtc_pending |= RTC_CTRLABUSY_bm;
+    timer_sync_commit();
+}
+
+#ifndef TIMER_FREE_RUNNING
+/*!    \brief Write-behind RTC.PER.
+**
+** Shall be called with interrupts disabled.
+**
+**    \param [in] per - value for RTC.PER.
+**
+**    \return Nothing.
+**/
+static void timer_sync_write_per(uint16_t per)
+{
+    rtc_per_shadow = per;
+    rtc_pending |= RTC_PERBUSY_bm;
+    timer_sync_commit();
+}
+#endif /* TIMER_FREE_RUNNING */
+
+#ifdef TIMER_FREE_RUNNING
+/* Index of the channel used by the system timer API (timer_start_*).
+ * Channels returned by timer_channel_open follow it.
+ */
+#define TIMER_SYSTEM_CHANNEL       0
+#define TIMER_TOTAL_CHANNELS       (TIMER_CHANNELS + 1)
+
+/*!    \brief Virtual timer channel control structure
+**
+** Armed channels are linked in a doubly linked list sorted by
+** deadline (expiry list). Links are channel indexes so that the
+** whole structure stays small.
+**/
+struct timer_channel_ctrl
+{
+    uint32_t deadline; /** Tick of the next expiry. */
+    uint32_t period;   /** Reload in ticks for continuous mode, 0 for one-shot. */
+    timer_callback_t callback; /** Callback to executed during expiration. */
+    timer_channel_t next; /** Next channel to expire. */
+    timer_channel_t prev; /** Previous channel to expire. */
+    bool armed;        /** Channel is in the expiry list. */
+};
+
+static volatile struct timer_channel_ctrl channels[TIMER_TOTAL_CHANNELS];
+
+/** Channel with the earliest deadline. TIMER_CHANNEL_NONE if the list is empty. */
+static volatile timer_channel_t expiry_head;
+
+/** Number of channels handed out by timer_channel_open. */
+static uint8_t channels_opened;
+
+/** Upper 16 bits of the free running tick: incremented on each
+ ** RTC overflow.
+ **/
+static volatile uint16_t rtc_overflows;
+
+/** Milliseconds at the start of the current 16-bit epoch of the
+ ** counter. Kept apart from rtc_overflows so that timer_get_ms
+ ** wraps at 2^32 ms rather than at 2^32 ticks.
+ **/
+static volatile uint32_t rtc_epoch_ms;
+
+/** Tick of the last value written to RTC.CMP. */
+static uint32_t rtc_cmp_target;
+
+/*!    \brief Read the 32-bit free running tick.
+**
+** Shall be called with interrupts disabled.
+** Accounts for an overflow that happened but whose interrupt
+** didn't run yet.
+**
+**    \return Current tick.
+**/
+static uint32_t timer_read_tick(void)
+{
+    uint16_t ovf = rtc_overflows;
+    uint16_t cnt = RTC.CNT;
+
+    if((RTC.INTFLAGS & RTC_OVF_bm) && (cnt < 0x8000))
+    {
+        /* Counter wrapped but overflow is still pending. */
+        ovf++;
+    }
+    return ((uint32_t)ovf << 16) | cnt;
+}
+
+/*!    \brief Read the free running tick in milliseconds.
+**
+** Shall be called with interrupts disabled. Same pending overflow
+** handling as timer_read_tick.
+**
+**    \return Milliseconds since timer_init.
+**/
+static uint32_t timer_read_ms(void)
+{
+    uint32_t epoch = rtc_epoch_ms;
+    uint16_t cnt = RTC.CNT;
+
+    if((RTC.INTFLAGS & RTC_OVF_bm) && (cnt < 0x8000))
+    {
+        epoch += TIMER_EPOCH_MS;
+    }
+    return epoch + ((uint32_t)cnt * 1000) / TIMER_TICKS_PER_SEC;
+}
+
+/*!    \brief Program the compare unit for the head of the expiry list.
+**
+** Shall be called with interrupts disabled.
+**
+** Compare interrupt is only enabled when the deadline falls in the
+** current 16-bit epoch of the counter. Otherwise, overflow interrupt
+** will reprogram it when the right epoch is reached.
+**
+**    \return Nothing.
+**/
+static void timer_arm_compare(void)
+{
+    uint32_t now;
+    uint32_t target;
+
+    if(expiry_head == TIMER_CHANNEL_NONE)
+    {
+        RTC.INTCTRL = RTC_OVF_bm;
+        return;
+    }
+    now = timer_read_tick();
+    target = channels[expiry_head].deadline;
+    if((int32_t)(target - now) < TIMER_MIN_LEAD_TICKS)
+    {
+        /* Too close (or late): expire as soon as possible. */
+        target = now + TIMER_MIN_LEAD_TICKS;
+    }
+    if(RTC.STATUS & RTC_CMPBUSY_bm)
+    {
+        if((int32_t)(target - rtc_cmp_target) < 0)
+        {
+            /* Earlier than the value still synchronising: its match
+             * would come too late. Rare, wait (2 RTC cycles at most).
+             */
+            while(RTC.STATUS & RTC_CMPBUSY_bm);
+        }
+        else
+        {
+            /* Retry later: the match of the value synchronising (or the
+             * overflow, if it is in a later epoch) comes first. Make sure
+             * its interrupt is on: the list may have been empty meanwhile.
+             */
+            rtc_pending |= RTC_CMPBUSY_bm;
+            if((uint16_t)(rtc_cmp_target >> 16) == (uint16_t)(now >> 16))
+            {
+                RTC.INTCTRL = RTC_OVF_bm | RTC_CMP_bm;
+            }
+            return;
+        }
+    }
+    rtc_pending &= ~RTC_CMPBUSY_bm;
+    rtc_cmp_target = target;
+    RTC.CMP = (uint16_t)target;
+    /* Discard any stale match. */
+    RTC.INTFLAGS = RTC_CMP_bm;
+    if((uint16_t)(target >> 16) == (uint16_t)(now >> 16))
+    {
+        RTC.INTCTRL = RTC_OVF_bm | RTC_CMP_bm;
+    }
+    else
+    {
+        RTC.INTCTRL = RTC_OVF_bm;
+    }
+}
+
+/*!    \brief Remove a channel from the expiry list.
+**
+** Shall be called with interrupts disabled. O(1).
+** Compare unit is not reprogrammed: if the channel was the head,
+** next compare interrupt will just find nothing to expire.
+**
+**    \param [in] ch - channel to remove.
+**
+**    \return Nothing.
+**/
+static void timer_channel_unlink(timer_channel_t ch)
+{
+    volatile struct timer_channel_ctrl *c = &channels[ch];
+
+    if(!c->armed)
+    {
+        return;
+    }
+    if(c->prev != TIMER_CHANNEL_NONE)
+    {
+        channels[c->prev].next = c->next;
+    }
+    else
+    {
+        expiry_head = c->next;
+    }
+    if(c->next != TIMER_CHANNEL_NONE)
+    {
+        channels[c->next].prev = c->prev;
+    }
+    c->armed = false;
+}
+
+/*!    \brief Insert a channel in the expiry list.
+**
+** Shall be called with interrupts disabled. The list is kept
+** sorted by deadline, channels with the same deadline expire
+** in insertion order.
+**
+**    \param [in] ch - channel to insert. Its deadline must be set.
+**
+**    \return true if the channel became the head of the list.
+**/
+static bool timer_channel_link(timer_channel_t ch)
+{
+    volatile struct timer_channel_ctrl *c = &channels[ch];
+    timer_channel_t prev = TIMER_CHANNEL_NONE;
+    timer_channel_t next = expiry_head;
+
+    while((next != TIMER_CHANNEL_NONE) &&
+          ((int32_t)(channels[next].deadline - c->deadline) <= 0))
+    {
+        prev = next;
+        next = channels[next].next;
+    }
+    c->prev = prev;
+    c->next = next;
+    if(prev != TIMER_CHANNEL_NONE)
+    {
+        channels[prev].next = ch;
+    }
+    else
+    {
+        expiry_head = ch;
+    }
+    if(next != TIMER_CHANNEL_NONE)
+    {
+        channels[next].prev = ch;
+    }
+    c->armed = true;
+    return prev == TIMER_CHANNEL_NONE;
+}
+
+/*!    \brief (Re)arm a channel.
+**
+** Shall be called with interrupts disabled.
+**
+**    \param [in] ch - channel to arm.
+**    \param [in] ticks  - Ticks from now to the expiry.
+**    \param [in] continuos - Run channel in continuous or one-shot
+**
+**    \return Nothing.
+**/
+static void timer_channel_arm(timer_channel_t ch, uint32_t ticks, bool continuous)
+{
+    if(ticks > TIMER_MAX_DELAY_TICKS)
+    {
+        ticks = TIMER_MAX_DELAY_TICKS;
+    }
+    timer_channel_unlink(ch);
+    channels[ch].period = continuous ? ticks : 0;
+    channels[ch].deadline = timer_read_tick() + ticks;
+    if(timer_channel_link(ch))
+    {
+        timer_arm_compare();
+    }
+}
+
+/*!    \brief Common function to start the various timers.
+**
+** Groups the common code to schedule the system timer on the
+** free running counter.
+**
+**    \param [in] ticks  - Ticks from now to the expiry.
+**    \param [in] presc  - Ignored: prescaler is fixed in free running mode.
+**    \param [in] clbk   - Callback to execute when timer expires.
+**    \param [in] continuos - Run timer in continuous or one-shot
+**
+**  \return Nothing.
+**/
+static void timer_start_common(timer_ticks_t ticks, RTC_PRESCALER_t presc,
+                               timer_callback_t clbk, bool continuous)
+{
+    interrupts_state_t sreg;
+
+    (void)presc;
+    sreg = interrupts_save_off();
+    timer_sync_commit();
+    /* System timer is busy as long as it holds a callback. */
+    if(channels[TIMER_SYSTEM_CHANNEL].callback == NULL)
+    {
+        channels[TIMER_SYSTEM_CHANNEL].callback = clbk;
+        timer_channel_arm(TIMER_SYSTEM_CHANNEL, ticks, continuous);
+    }
+    interrupts_restore(sreg);
+}
+#else /* TIMER_FREE_RUNNING */
 /*!    \brief Timer private control structure
 **/
 struct timer_ctrl
@@ -86,60 +513,58 @@ volatile struct timer_ctrl sys_timer;
 **
 **  \return Nothing.
 **/
-static void timer_start_common(uint16_t ticks, RTC_PRESCALER_t presc,
+static void timer_start_common(timer_ticks_t ticks, RTC_PRESCALER_t presc,
                                timer_callback_t clbk, bool continuous)
 {
-    interrupts_off();
-    /* Atomically check timer is free and make it busy
-     * Can't use timer_is_free due to interrupts_off/on nesting.
-     */
+    interrupts_state_t sreg;
+
+    sreg = interrupts_save_off();
+    /* Atomically check timer is free and make it busy */
     if(sys_timer.callback != NULL)
     {
+        interrupts_restore(sreg);
         return;
     }
     sys_timer.callback = clbk;
-    interrupts_on();
-
-    /* Once we obtained the timer, we can set the rest of the structure
-     * safely.
-     */
     sys_timer.ticks = ticks;
     sys_timer.prescaler = presc;
     sys_timer.continuous = continuous;
-
-
-    while(RTC.STATUS != 0);
     /* We only use RTC overflow feature. Set the clock overflow value (RTC.PER) and
      * enable overflow interrupt */
-    RTC.PER = sys_timer.ticks;
+    timer_sync_write_per(sys_timer.ticks);
     RTC.INTCTRL = RTC_OVF_bm;
-    /* Set the prescaler and enable the RTC.
+    /* Set the prescaler and enable the RTC (committed after RTC.PER).
      */
-    RTC.CTRLA |= (sys_timer.prescaler | RTC_RTCEN_bm);
+    timer_sync_write_ctrla((rtc_ctrla_shadow & RTC_RUNSTDBY_bm) |
+                           sys_timer.prescaler | RTC_RTCEN_bm);
+    interrupts_restore(sreg);
 }
+#endif /* TIMER_FREE_RUNNING */
 
-#ifdef TIMER_ENABLED_IN_SLEEP
 /*!    \brief Timer one-off initialisation for sleep mode
 **
-** Function to register with the sleep subsystem for sleep
-** mode.
+** On-init handler listed in sleep_config.h.
 **
 ** Configure the timer hardware to enter sleep mode.
 ** Configure timer hardware to remain active during sleep.
 **
 **  \return Nothing.
 **/
-static void timer_init_for_sleep(void)
+void timer_sleep_on_init(void)
 {
-    while(RTC.STATUS & RTC_CTRLABUSY_bm);
+#ifdef TIMER_ENABLED_IN_SLEEP
+    interrupts_state_t sreg;
+
+    sreg = interrupts_save_off();
     /* Enable device during deep sleep. */
-    RTC.CTRLA |= RTC_RUNSTDBY_bm;
+    timer_sync_write_ctrla(rtc_ctrla_shadow | RTC_RUNSTDBY_bm);
+    interrupts_restore(sreg);
+#endif /* TIMER_ENABLED_IN_SLEEP */
 }
 
 /*!    \brief Configure the timer hardware for sleep mode.
 **
-** Function to register with the sleep subsystem for sleep
-** mode.
+** On-enter handler listed in sleep_config.h.
 **
 ** Configure the timer hardware to enter sleep mode.
 ** Mainly used to determine which clock source should be used
@@ -147,8 +572,17 @@ static void timer_init_for_sleep(void)
 **
 **    \return Nothing.
 **/
-static void timer_on_enter_sleep(void)
+void timer_sleep_on_enter(void)
 {
+#ifdef TIMER_ENABLED_IN_SLEEP
+    /* Nobody would commit pending writes while sleeping: this is the
+     * only place where we wait for the RTC to synchronise. It only
+     * happens if a register was written in the last ~60us.
+     */
+    while(rtc_pending != 0)
+    {
+        timer_sync_commit();
+    }
 #ifdef TIMER_USE_LP_CLOCK_IN_SLEEP
     /* Use internal ULP oscillator @32kHz as low power clock source.
      *
@@ -158,49 +592,98 @@ static void timer_on_enter_sleep(void)
      */
     RTC.CLKSEL = RTC_CLKSEL_INT32K_gc;
 #endif /* TIMER_USE_LP_CLOCK_IN_SLEEP */
+#endif /* TIMER_ENABLED_IN_SLEEP */
 }
 
 /*!    \brief Configure the timer hardware for active mode.
 **
-** Function to register with the sleep subsystem for sleep
-** mode.
+** On-exit handler listed in sleep_config.h.
 **
 ** Configure the timer hardware for active mode.
 ** Restore active settings that have been changed
-** by timer_on_enter_sleep.
+** by timer_sleep_on_enter.
 **
 **    \return Nothing.
 **/
-static void timer_on_exit_sleep(void)
+void timer_sleep_on_exit(void)
 {
-#ifdef TIMER_USE_LP_CLOCK_IN_SLEEP
+#if defined(TIMER_ENABLED_IN_SLEEP) && defined(TIMER_USE_LP_CLOCK_IN_SLEEP)
     /* Restore external crystal as power source.
      */
     RTC.CLKSEL = RTC_CLKSEL_TOSC32K_gc;
-#endif /* TIMER_USE_LP_CLOCK_IN_SLEEP */
+#endif
 }
-#endif /* TIMER_ENABLED_IN_SLEEP */
 
+#ifdef TIMER_FREE_RUNNING
 ISR(RTC_CNT_vect)
 {
+    ISR_PROFILE_SCOPE(isr_profile_rtc_cnt);
+    timer_channel_t ch;
+    timer_callback_t clbk;
+    uint8_t flags = RTC.INTFLAGS;
+
+    sleep_note_wakeup(SLEEP_WAKEUP_RTC);
+    /* Acknowledge interrupts */
+    RTC.INTFLAGS = flags;
+    if(flags & RTC_OVF_bm)
+    {
+        rtc_overflows++;
+        rtc_epoch_ms += TIMER_EPOCH_MS;
+    }
+    timer_sync_commit();
+    /* Expire all the channels whose deadline is past. */
+    ch = expiry_head;
+    while((ch != TIMER_CHANNEL_NONE) &&
+          ((int32_t)(channels[ch].deadline - timer_read_tick()) <= 0))
+    {
+        clbk = channels[ch].callback;
+        timer_channel_unlink(ch);
+        if(channels[ch].period != 0)
+        {
+            /* Next expiry is relative to the previous deadline: no drift. */
+            channels[ch].deadline += channels[ch].period;
+            timer_channel_link(ch);
+        }
+        else if(ch == TIMER_SYSTEM_CHANNEL)
+        {
+            /* Release the system timer before the callback: it can restart it. */
+            channels[ch].callback = NULL;
+        }
+        /* Execute the callback */
+        (*clbk)();
+        ch = expiry_head;
+    }
+    /* Program the compare unit for the new head (or the right epoch). */
+    timer_arm_compare();
+}
+#else /* TIMER_FREE_RUNNING */
+ISR(RTC_CNT_vect)
+{
+    ISR_PROFILE_SCOPE(isr_profile_rtc_cnt);
+    sleep_note_wakeup(SLEEP_WAKEUP_RTC);
     /* Acknowledge interrupt */
     RTC.INTFLAGS &= RTC_OVF_bm;
+    timer_sync_commit();
     /* Execute the callback */
     (*sys_timer.callback)();
     if(!sys_timer.continuous)
     {
         /* Disable timer if in one-shot mode. */
-        RTC.CTRLA = 0;
+        timer_sync_write_ctrla(rtc_ctrla_shadow & RTC_RUNSTDBY_bm);
         sys_timer.callback = NULL;
     }
 }
+#endif /* TIMER_FREE_RUNNING */
 
 void timer_init(void)
 {
     uint32_t wait = 1000000; //50ms very approximate
-
+#ifdef TIMER_FREE_RUNNING
+    timer_channel_t ch;
+#else
     /* Init control structure. No protection: assumes interrupts are disabled. */
     sys_timer.callback = NULL;
+#endif
 
     /* Enable external 32KHz Xtal */
     _PROTECTED_WRITE(CLKCTRL.XOSC32KCTRLA, CLKCTRL_ENABLE_bm);
@@ -214,66 +697,242 @@ void timer_init(void)
     while(RTC.STATUS != 0);
     /* Select clock source to 32.768 kHz external oscillator */
     RTC.CLKSEL = RTC_CLKSEL_TOSC32K_gc;
+    rtc_pending = 0;
+    rtc_ctrla_shadow = 0;
 
-#ifdef TIMER_ENABLED_IN_SLEEP
-    sleep_register_peripheral( timer_init_for_sleep,
-                               timer_on_enter_sleep,
-                               timer_on_exit_sleep);
+#ifdef TIMER_FREE_RUNNING
+    for(ch = 0; ch < TIMER_TOTAL_CHANNELS; ch++)
+    {
+        channels[ch].callback = NULL;
+        channels[ch].armed = false;
+    }
+    expiry_head = TIMER_CHANNEL_NONE;
+    channels_opened = 0;
+
+    /* Start the counter once and for all: it will wrap at 0xFFFF and
+     * overflows extend it to 32 bits.
+     */
+    rtc_overflows = 0;
+    rtc_epoch_ms = 0;
+    rtc_cmp_target = 0;
+    RTC.CNT = 0;
+    RTC.PER = UINT16_MAX;
+    RTC.INTFLAGS = RTC_OVF_bm | RTC_CMP_bm;
+    RTC.INTCTRL = RTC_OVF_bm;
+    rtc_ctrla_shadow = TIMER_TICK_PRESCALER_MASK | RTC_RTCEN_bm;
+    while(RTC.STATUS != 0);
+    RTC.CTRLA = rtc_ctrla_shadow;
+#endif
+#ifdef TIMER_HIGH_PRIORITY
+    interrupts_priority_elevate(RTC_CNT_vect_num);
 #endif
 }
 
 bool timer_is_free(void)
 {
     bool res;
+    interrupts_state_t sreg;
 
-    interrupts_off();
+    sreg = interrupts_save_off();
+    timer_sync_commit();
+#ifdef TIMER_FREE_RUNNING
+    res = channels[TIMER_SYSTEM_CHANNEL].callback == NULL;
+#else
     res = sys_timer.callback == NULL;
-    interrupts_on();
+#endif
+    interrupts_restore(sreg);
     return res;
 }
 
 void timer_start_one_shot_ms(uint16_t ms, timer_callback_t clbk)
 {
-    uint16_t ticks = rtcTicksFromMilliseconds(ms);
+    timer_ticks_t ticks = rtcTicksFromMilliseconds(ms);
     timer_start_common(ticks, TIMER_MS_PRESCALER_MASK, clbk, false);
 }
 
 void timer_start_continuous_ms(uint16_t ms, timer_callback_t clbk)
 {
-    uint16_t ticks = rtcTicksFromMilliseconds(ms);
+    timer_ticks_t ticks = rtcTicksFromMilliseconds(ms);
     timer_start_common(ticks, TIMER_MS_PRESCALER_MASK, clbk, true);
 }
 
 void timer_start_one_shot_sec(uint16_t sec, timer_callback_t clbk)
 {
-    uint16_t ticks = rtcTicksFromSeconds(sec);
+    timer_ticks_t ticks = rtcTicksFromSeconds(sec);
     timer_start_common(ticks, TIMER_SEC_PRESCALER_MASK, clbk, false);
 }
 
 void timer_start_continuous_sec(uint16_t sec, timer_callback_t clbk)
 {
-    uint16_t ticks = rtcTicksFromSeconds(sec);
+    timer_ticks_t ticks = rtcTicksFromSeconds(sec);
     timer_start_common(ticks, TIMER_SEC_PRESCALER_MASK, clbk, true);
 }
 
 void timer_start_one_shot_min(uint16_t min, timer_callback_t clbk)
 {
-    uint16_t ticks = rtcTicksFromMinutes(min);
+    timer_ticks_t ticks = rtcTicksFromMinutes(min);
     timer_start_common(ticks, TIMER_MIN_PRESCALER_MASK, clbk, false);
 }
 
 void timer_start_continuous_min(uint16_t min, timer_callback_t clbk)
 {
-    uint16_t ticks = rtcTicksFromMinutes(min);
+    timer_ticks_t ticks = rtcTicksFromMinutes(min);
     timer_start_common(ticks, TIMER_MIN_PRESCALER_MASK, clbk, true);
 }
 
+#ifdef TIMER_FREE_RUNNING
+/** Counter is never stopped: just release the system timer
+ ** channel.
+ **/
 void timer_stop(void)
 {
-    while(RTC.STATUS);
-    RTC.CTRLA = 0;
-    interrupts_off();
+    interrupts_state_t sreg;
+
+    sreg = interrupts_save_off();
+    timer_sync_commit();
+    timer_channel_unlink(TIMER_SYSTEM_CHANNEL);
+    channels[TIMER_SYSTEM_CHANNEL].callback = NULL;
+    interrupts_restore(sreg);
+}
+
+uint32_t timer_get_tick(void)
+{
+    uint32_t tick;
+    interrupts_state_t sreg;
+
+    sreg = interrupts_save_off();
+    timer_sync_commit();
+    tick = timer_read_tick();
+    interrupts_restore(sreg);
+    return tick;
+}
+
+uint32_t timer_get_ms(void)
+{
+    uint32_t ms;
+    interrupts_state_t sreg;
+
+    sreg = interrupts_save_off();
+    timer_sync_commit();
+    ms = timer_read_ms();
+    interrupts_restore(sreg);
+    return ms;
+}
+
+uint32_t timer_next_deadline(void)
+{
+    uint32_t ticks = TIMER_NO_DEADLINE;
+    int32_t left;
+    interrupts_state_t sreg;
+
+    sreg = interrupts_save_off();
+    if(expiry_head != TIMER_CHANNEL_NONE)
+    {
+        left = (int32_t)(channels[expiry_head].deadline - timer_read_tick());
+        ticks = (left > 0) ? (uint32_t)left : 0;
+    }
+    interrupts_restore(sreg);
+    return ticks;
+}
+
+timer_channel_t timer_channel_open(timer_callback_t clbk)
+{
+    timer_channel_t ch = TIMER_CHANNEL_NONE;
+    interrupts_state_t sreg;
+
+    sreg = interrupts_save_off();
+    if((clbk != NULL) && (channels_opened < TIMER_CHANNELS))
+    {
+        channels_opened++;
+        ch = TIMER_SYSTEM_CHANNEL + channels_opened;
+        channels[ch].callback = clbk;
+    }
+    interrupts_restore(sreg);
+    return ch;
+}
+
+/*!    \brief Check a channel was handed out by timer_channel_open.
+**
+** Other channels have no callback: arming them would make the ISR
+** call NULL.
+**/
+static bool timer_channel_is_open(timer_channel_t ch)
+{
+    return (ch > TIMER_SYSTEM_CHANNEL) && (ch <= TIMER_SYSTEM_CHANNEL + channels_opened);
+}
+
+void timer_channel_start_one_shot_ms(timer_channel_t ch, uint16_t ms)
+{
+    timer_channel_start_ticks(ch, rtcTicksFromMilliseconds(ms), false);
+}
+
+void timer_channel_start_continuous_ms(timer_channel_t ch, uint16_t ms)
+{
+    timer_channel_start_ticks(ch, rtcTicksFromMilliseconds(ms), true);
+}
+
+void timer_channel_start_ticks(timer_channel_t ch, uint32_t ticks, bool continuous)
+{
+    interrupts_state_t sreg;
+
+    if(!timer_channel_is_open(ch))
+    {
+        return;
+    }
+    sreg = interrupts_save_off();
+    timer_sync_commit();
+    timer_channel_arm(ch, ticks, continuous);
+    interrupts_restore(sreg);
+}
+
+void timer_channel_stop(timer_channel_t ch)
+{
+    interrupts_state_t sreg;
+
+    if(!timer_channel_is_open(ch))
+    {
+        return;
+    }
+    sreg = interrupts_save_off();
+    timer_sync_commit();
+    timer_channel_unlink(ch);
+    interrupts_restore(sreg);
+}
+
+bool timer_channel_is_running(timer_channel_t ch)
+{
+    if((ch != TIMER_SYSTEM_CHANNEL) && !timer_channel_is_open(ch))
+    {
+        return false;
+    }
+    return channels[ch].armed;
+}
+#else /* TIMER_FREE_RUNNING */
+void timer_stop(void)
+{
+    interrupts_state_t sreg;
+
+    sreg = interrupts_save_off();
+    timer_sync_write_ctrla(rtc_ctrla_shadow & RTC_RUNSTDBY_bm);
     sys_timer.callback = NULL;
-    interrupts_on();
+    interrupts_restore(sreg);
+}
+
+/** Counter is restarted on each timer start: only meaningful
+ ** while a timer is running.
+ **/
+uint32_t timer_get_tick(void)
+{
+    return RTC.CNT;
+}
+#endif /* TIMER_FREE_RUNNING */
+
+void timer_poll(void)
+{
+    interrupts_state_t sreg;
+
+    sreg = interrupts_save_off();
+    timer_sync_commit();
+    interrupts_restore(sreg);
 }
 /****************************************************************/
@@ -17,8 +17,18 @@ extern "C" {
 
 #include <inttypes.h>
 #include <stdbool.h>
+#include "timer_config.h"
 /****************************************************************/
 
+#ifdef TIMER_FREE_RUNNING
+/*!    \brief Frequency of the free running tick (timer_get_tick()).
+**
+** Use it to convert tick counts from timer_get_tick() (i.e. residency,
+** timeouts) into time.
+**/
+#define TIMER_TICKS_PER_SEC ((uint32_t)TIMER_OSC_FREQ_HZ / TIMER_TICK_FREQ_DIV)
+#endif
+
 /*!    \brief Type for system timer callbacks.
 **
 ** System timer callback gets called when the timer expires.
@@ -122,17 +132,160 @@ void timer_start_continuous_min(uint16_t min, timer_callback_t clbk);
 **/
 void timer_stop(void);
 
+/*!    \brief Commit pending timer hardware settings.
+**
+** Timer hardware registers take a while to synchronise after a write.
+** Instead of waiting, the timer module postpones writes that can't be
+** performed yet and commits them on the next call to any timer API,
+** on the next timer interrupt or before entering sleep. A deadline
+** earlier than the one being synchronised is the exception: it waits
+** for the synchronisation (2 RTC cycles at most), as it can't be late.
+** Call this function (i.e. from the main loop) if none of the above
+** is guaranteed to happen soon.
+**
+**    \return Nothing.
+**/
+void timer_poll(void);
+
+/*!    \brief Sleep handlers.
+**
+** On-init, on-enter and on-exit handlers of the timer, to be listed
+** in sleep_config.h. They keep the timer running during sleep
+** (see TIMER_ENABLED_IN_SLEEP in timer_config.h). Not meant to be
+** called by users.
+**/
+void timer_sleep_on_init(void);
+void timer_sleep_on_enter(void);
+void timer_sleep_on_exit(void);
+
 /*!    \brief Get system timer value.
 **
 ** Read the value of the hardware counter used to implement
 ** the system timer.
 **
-** TODO: For the dispatcher interface to work, this probably
-** needs to be a number in ms.
+** When the RTC is free running (TIMER_FREE_RUNNING), this is a
+** monotonic tick at TIMER_TICKS_PER_SEC that never stops nor restarts
+** and only wraps at 2^32. Otherwise, the counter restarts on each
+** timer start.
 **
 **    \return Number of ticks in the hardware counter.
 **/
-uint16_t timer_get_tick(void);
+uint32_t timer_get_tick(void);
+
+/*!    \brief Get the time since timer_init in milliseconds.
+**
+** Same timebase as timer_get_tick, converted to milliseconds: use it
+** to compute deadlines for the timer_start_*_ms/sec/min API. Wraps
+** at 2^32 ms (~49 days).
+**
+** Only available when the timer runs in free running mode
+** (TIMER_FREE_RUNNING in timer_config.h).
+**
+**    \return Milliseconds since timer_init.
+**/
+uint32_t timer_get_ms(void);
+
+/*!    \brief No pending timer deadline.
+**/
+#define TIMER_NO_DEADLINE 0xFFFFFFFFUL
+
+/*!    \brief Get the time left until the next timer expiry.
+**
+** Earliest deadline among the system timer and the virtual timer
+** channels, i.e. the next timed wake-up (see sleep_auto).
+**
+** Only available when the timer runs in free running mode
+** (TIMER_FREE_RUNNING in timer_config.h).
+**
+**    \return Ticks (timer_get_tick()) until the next expiry, 0 if
+**            overdue, TIMER_NO_DEADLINE if no timer is running.
+**/
+uint32_t timer_next_deadline(void);
+
+/*!    \brief Type for virtual timer channels.
+**
+** Virtual timer channels multiplex the hardware timer so that
+** drivers (i.e. needing a timeout) can use it independently from
+** the system timer API above.
+**
+** Only available when the timer runs in free running mode
+** (TIMER_FREE_RUNNING in timer_config.h).
+**/
+typedef uint8_t timer_channel_t;
+
+/*!    \brief Invalid virtual timer channel.
+**/
+#define TIMER_CHANNEL_NONE 0xFF
+
+/*!    \brief Obtain a virtual timer channel.
+**
+** Channels are statically allocated (see TIMER_CHANNELS in
+** timer_config.h) and can't be released: call once at
+** driver initialisation.
+**
+**    \param [in] clbk - Callback to execute when the channel expires.
+**                       It runs in interrupt context.
+**
+**    \return Channel to use with timer_channel_* API.
+**            TIMER_CHANNEL_NONE if no channel is available.
+**/
+timer_channel_t timer_channel_open(timer_callback_t clbk);
+
+/*!    \brief Start a virtual timer channel in one-shot mode
+**
+** Execute the channel callback after "ms" milliseconds from now.
+** Starting a channel that is already running moves its expiry.
+**
+**    \param [in] ch   - channel returned by timer_channel_open.
+**    \param [in] ms   - expiration time from now in milliseconds.
+**
+**    \return Nothing.
+**/
+void timer_channel_start_one_shot_ms(timer_channel_t ch, uint16_t ms);
+
+/*!    \brief Start a virtual timer channel in continuous mode
+**
+** Execute the channel callback every "ms" milliseconds from now.
+** Use timer_channel_stop to stop it.
+**
+**    \param [in] ch   - channel returned by timer_channel_open.
+**    \param [in] ms   - period in milliseconds.
+**
+**    \return Nothing.
+**/
+void timer_channel_start_continuous_ms(timer_channel_t ch, uint16_t ms);
+
+/*!    \brief Start a virtual timer channel using hardware ticks
+**
+** Same as timer_channel_start_one_shot_ms/timer_channel_start_continuous_ms
+** but expressed in ticks of the free running counter (timer_get_tick) for
+** sub-millisecond timeouts.
+**
+**    \param [in] ch    - channel returned by timer_channel_open.
+**    \param [in] ticks - expiration time (or period) from now in ticks.
+**    \param [in] continuous - restart the channel each time it expires.
+**
+**    \return Nothing.
+**/
+void timer_channel_start_ticks(timer_channel_t ch, uint32_t ticks, bool continuous);
+
+/*!    \brief Stop a virtual timer channel
+**
+** Stop the channel if running. O(1).
+**
+**    \param [in] ch   - channel returned by timer_channel_open.
+**
+**    \return Nothing.
+**/
+void timer_channel_stop(timer_channel_t ch);
+
+/*!    \brief Check if a virtual timer channel is running
+**
+**    \param [in] ch   - channel returned by timer_channel_open.
+**
+**    \return true if the channel is waiting to expire.
+**/
+bool timer_channel_is_running(timer_channel_t ch);
 
 /****************************************************************/
 #ifdef __cplusplus
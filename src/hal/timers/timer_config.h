@@ -2,8 +2,9 @@
 ** \author 
 ** \copyright TODO
 ** \brief Static configuration for system timer.
-** \details This is a private header that can be used to statically configure
-**          the megavr implementation of the driver.
+** \details Static configuration of the megavr implementation of the driver.
+**          Included by timer.h: drivers sharing the timebase (sleep,
+**          watchdog) get the tick rate from there.
 **/
 /****************************************************************/
 #ifndef __TIMER_CONFIG_H
@@ -50,6 +51,36 @@ extern "C" {
 **/
 #define TIMER_MIN_FREQ_DIV 16384  // 499,7 ms, ~9h max range
 
+/*!    \brief Run the RTC as a free running counter.
+**
+** Define this flag to never stop the RTC once initialised. The counter
+** is extended to a 32-bit monotonic tick by counting its overflows and
+** expiries are scheduled using the RTC compare unit (RTC.CMP).
+** This gives a drift-free timebase (timer_get_tick) and avoids stopping,
+** reloading and re-synchronising the RTC each time a timer is started.
+**
+** Undefine to fall back to the legacy mode where RTC.PER and the prescaler
+** are reprogrammed on each timer start.
+**/
+#define TIMER_FREE_RUNNING
+
+/*!    \brief Frequency divider for the free running tick.
+**
+** Only used with TIMER_FREE_RUNNING. RTC will always run at a frequency
+** equal to TIMER_OSC_FREQ/TIMER_TICK_FREQ_DIV. All the ms, sec, min timers
+** share this resolution.
+** Hardware counter overflows (and wakes the device up) every 2^16 ticks.
+**/
+#define TIMER_TICK_FREQ_DIV 32 //976us resolution, overflow every 64 sec
+
+/*!    \brief Number of virtual timer channels.
+**
+** Only used with TIMER_FREE_RUNNING. Number of channels that can be
+** obtained through timer_channel_open(), in addition to the one used
+** by the system timer API (timer_start_*).
+**/
+#define TIMER_CHANNELS 4
+
 /*!    \brief Keep the timer running during sleep mode.
 **
 ** Define this flag to have the timer hardware running when the device
@@ -65,5 +96,13 @@ extern "C" {
 **/
 // #define TIMER_USE_LP_CLOCK_IN_SLEEP
 
+/*!    \brief Run the timer interrupt at high priority.
+**
+** Define to assign level 1 priority to the RTC vector: timer callbacks
+** then preempt any other ISR (see interrupts_priority_elevate). Only one
+** vector can be at level 1.
+**/
+// #define TIMER_HIGH_PRIORITY
+
 #endif /* __TIMER_CONFIG_H */
 /****************************************************************/
@@ -29,6 +29,13 @@ struct timer_control
 
 struct timer_control timerCtrl;
 
+/*!    \brief Number of times the stubbed HAL timer expired.
+**
+** Used by unit tests to verify how many wake-ups a client
+** of the timer HAL requires to reach a deadline.
+**/
+uint32_t timer_expiries = 0;
+
 /*!    \brief Stub to timer_init HAL function.
 **/
 void timer_init(void)
@@ -56,9 +63,38 @@ void timer_start_one_shot_ms(uint16_t ms, timer_callback_t clbk)
     timerCtrl.clbk = clbk;
 }
 
+/*!    \brief Stub to timer_start_one_shot_sec HAL function.
+**
+** ut_timer counts milliseconds: deadline is converted accordingly.
+**/
+void timer_start_one_shot_sec(uint16_t sec, timer_callback_t clbk)
+{
+    timer_start_one_shot_ms(0, clbk);
+    timerCtrl.next_expiry += (uint32_t)sec * 1000;
+}
+
+/*!    \brief Stub to timer_start_one_shot_min HAL function.
+**
+** ut_timer counts milliseconds: deadline is converted accordingly.
+**/
+void timer_start_one_shot_min(uint16_t min, timer_callback_t clbk)
+{
+    timer_start_one_shot_ms(0, clbk);
+    timerCtrl.next_expiry += (uint32_t)min * 60000;
+}
+
 /*!    \brief Stub to timer_get_tick HAL function.
 **/
-uint16_t timer_get_tick(void)
+uint32_t timer_get_tick(void)
+{
+    return ut_timer;
+}
+
+/*!    \brief Stub to timer_get_ms HAL function.
+**
+** ut_timer counts milliseconds.
+**/
+uint32_t timer_get_ms(void)
 {
     return ut_timer;
 }
@@ -77,6 +113,15 @@ bool timer_host_is_timer_active(void)
 void timer_host_reset_time(void)
 {
     ut_timer = 0;
+    timer_expiries = 0;
+}
+
+/** This is not a stub but an helper to run the host timer
+ ** infrastructure.
+ **/
+uint32_t timer_host_get_expiries(void)
+{
+    return timer_expiries;
 }
 
 /** This is not a stub but an helper to run the host timer
@@ -97,6 +142,7 @@ void timer_host_elapse_time(uint32_t time)
         {
             /* De-activate timer. Callback may reactivate it. */
             timerCtrl.active = false;
+            timer_expiries++;
             timerCtrl.clbk();
             if(!timerCtrl.active)
             {
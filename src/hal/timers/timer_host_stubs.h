@@ -58,6 +58,13 @@ void timer_host_elapse_time(uint32_t time);
 **/
 bool timer_host_is_timer_active(void);
 
+/*!    \brief Number of stubbed HAL timer expiries.
+**
+** \return How many times the stubbed HAL timer expired
+**         since the last timer_host_reset_time().
+**/
+uint32_t timer_host_get_expiries(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,320 @@
+/*!\file timer_sync_test.cpp
+** \author
+** \copyright
+** \brief Unit test for RTC register synchronisation in timer.c
+** \details This file builds timer.c against the host stubs of the avr
+**          headers (host_stubs/avr) and verifies that timer API never
+**          stalls the cpu waiting for the RTC registers to synchronise.
+**
+**          Build with host_stubs before the system include paths, i.e.:
+**          g++ -x c++ -Ihost_stubs -I. -I../interrupts -I../sleep
+**              timer.c ../interrupts/interrupts_host_stubs.c timer_sync_test.cpp
+**/
+/****************************************************************/
+
+#include "timer.h"
+#include "sleep.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include<iostream>
+#include<functional>
+#include<string>
+#include<stdexcept>
+/****************************************************************/
+
+uint64_t rtc_sim_cycles = 0;
+uint32_t rtc_sim_status_reads = 0;
+uint32_t rtc_sim_busy_writes = 0;
+RTC_t RTC;
+CLKCTRL_t CLKCTRL;
+uint8_t SREG;
+volatile uint8_t sleep_wakeup_first;
+
+/** Worst-case stall seen so far, in cpu cycles. */
+static uint64_t worst_stall = 0;
+
+static void test_clbk(void) {}
+
+/*!    \brief Run a timer API call and measure how long it stalled.
+**
+** \param[in] name - description of the call for logging.
+** \param[in] call - API call to run.
+**
+** \return cpu cycles spent polling RTC.STATUS during the call.
+**/
+uint64_t measureStall(std::string name, std::function<void(void)> call)
+{
+    uint32_t reads = rtc_sim_status_reads;
+    uint64_t stall;
+
+    call();
+    stall = (uint64_t)(rtc_sim_status_reads - reads) * RTC_SIM_POLL_CYCLES;
+    std::cout << " " << name << ": stalled " << stall << " cycles" << std::endl;
+    if(stall > worst_stall)
+    {
+        worst_stall = stall;
+    }
+    return stall;
+}
+
+/*!    \brief Verify no RTC register was written while synchronising.
+**
+** \throws runtime_error in case of negative outcome.
+**/
+void verifyNoBusyWrites(void)
+{
+    std::cout << " Check no register was written while busy.";
+    if(rtc_sim_busy_writes != 0)
+    {
+        throw std::runtime_error("FAIL: RTC register written while synchronising!!");
+    }
+    std::cout << " - OK!" << std::endl;
+}
+
+/*!    \brief Verify back to back timer API calls never wait for the RTC.
+**/
+void testNoStall(void)
+{
+    std::cout << "  <<testNoStall>>" << std::endl;
+    timer_init();
+    timer_sleep_on_init();
+    timer_channel_t ch = timer_channel_open(test_clbk);
+
+    /* Each call reprograms the compare unit while the previous
+     * write is still synchronising, never with an earlier deadline
+     * (see testEarlierWhileBusy).
+     */
+    measureStall("timer_channel_start_one_shot_ms(5)", [ch]{ timer_channel_start_one_shot_ms(ch, 5); });
+    measureStall("timer_start_one_shot_ms(10)", []{ timer_start_one_shot_ms(10, test_clbk); });
+    measureStall("timer_stop()", []{ timer_stop(); });
+    measureStall("timer_start_continuous_ms(30)", []{ timer_start_continuous_ms(30, test_clbk); });
+    measureStall("RTC ISR", []{ rtc_cnt_vect_host(); });
+    verifyNoBusyWrites();
+
+    std::cout << " Check worst-case stall is a bounded number of polls.";
+    if(worst_stall > 4 * RTC_SIM_POLL_CYCLES)
+    {
+        throw std::runtime_error("FAIL: timer API waited for RTC synchronisation!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    std::cout << " Worst-case stall: " << worst_stall << " cycles (" << worst_stall / 16.0
+              << "us @16MHz). Busy-wait would be up to " << RTC_SIM_SYNC_CYCLES
+              << " cycles per write." << std::endl;
+    std::cout << std::endl;
+}
+
+/*!    \brief Verify postponed writes are committed by the next API call.
+**/
+void testDeferredCommit(void)
+{
+    std::cout << "  <<testDeferredCommit>>" << std::endl;
+    timer_init();
+    timer_sleep_on_init();
+
+    std::cout << "Start timer twice in a row: later compare value is postponed." << std::endl;
+    timer_start_one_shot_ms(10, test_clbk);
+    timer_stop();
+    timer_start_one_shot_ms(100, test_clbk);
+    std::cout << " RTC.CMP=" << (uint16_t)RTC.CMP << std::endl;
+    std::cout << " Check the compare interrupt is on to retry.";
+    if(!(RTC.INTCTRL & RTC_CMP_bm))
+    {
+        throw std::runtime_error("FAIL: nothing will retry the postponed write!!");
+    }
+    std::cout << " - OK!" << std::endl;
+
+    std::cout << "Let the RTC synchronise and poll." << std::endl;
+    rtc_sim_cycles += RTC_SIM_SYNC_CYCLES;
+    timer_poll();
+    std::cout << " Check RTC.CMP holds the last deadline (102 ticks). RTC.CMP=" << (uint16_t)RTC.CMP;
+    if(RTC.CMP != 102)
+    {
+        throw std::runtime_error("FAIL: postponed write was not committed!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    verifyNoBusyWrites();
+    std::cout << std::endl;
+}
+
+/*!    \brief Verify pending writes are flushed before sleeping.
+**/
+void testFlushBeforeSleep(void)
+{
+    std::cout << "  <<testFlushBeforeSleep>>" << std::endl;
+    timer_init();
+    timer_sleep_on_init();
+
+    timer_start_one_shot_ms(20, test_clbk);
+    timer_stop();
+    timer_start_one_shot_ms(100, test_clbk);
+    uint64_t stall = measureStall("sleep on_enter handler", []{ timer_sleep_on_enter(); });
+    std::cout << " Check RTC.CMP holds the last deadline (102 ticks). RTC.CMP=" << (uint16_t)RTC.CMP;
+    if(RTC.CMP != 102)
+    {
+        throw std::runtime_error("FAIL: pending write not flushed before sleep!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    std::cout << " Check flush waited at most one synchronisation.";
+    if(stall > RTC_SIM_SYNC_CYCLES + RTC_SIM_POLL_CYCLES)
+    {
+        throw std::runtime_error("FAIL: flush before sleep took too long!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    verifyNoBusyWrites();
+    std::cout << std::endl;
+}
+
+/*!    \brief Verify an earlier deadline is programmed while RTC.CMP
+**         synchronises, without waiting for a poll.
+**/
+void testEarlierWhileBusy(void)
+{
+    std::cout << "  <<testEarlierWhileBusy>>" << std::endl;
+    timer_init();
+    timer_sleep_on_init();
+    timer_channel_t ch = timer_channel_open(test_clbk);
+
+    timer_start_one_shot_ms(100, test_clbk);
+    uint64_t stall = measureStall("timer_channel_start_one_shot_ms(10)",
+                                  [ch]{ timer_channel_start_one_shot_ms(ch, 10); });
+    std::cout << " Check RTC.CMP holds the earlier deadline (10 ticks). RTC.CMP=" << (uint16_t)RTC.CMP;
+    if((RTC.CMP != 10) || !(RTC.INTCTRL & RTC_CMP_bm))
+    {
+        throw std::runtime_error("FAIL: earlier deadline left pending!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    std::cout << " Check it waited at most one synchronisation.";
+    if(stall > RTC_SIM_SYNC_CYCLES + RTC_SIM_POLL_CYCLES)
+    {
+        throw std::runtime_error("FAIL: waited too long!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    verifyNoBusyWrites();
+    std::cout << std::endl;
+}
+
+/*!    \brief Verify timer_get_ms follows the tick across counter overflows.
+**/
+void testMilliseconds(void)
+{
+    uint32_t prev;
+    uint32_t i;
+
+    std::cout << "  <<testMilliseconds>>" << std::endl;
+    timer_init();
+    RTC.CNT = TIMER_TICKS_PER_SEC;
+    std::cout << " Check one second of ticks is 1000 ms.";
+    if((timer_get_tick() != TIMER_TICKS_PER_SEC) || (timer_get_ms() != 1000))
+    {
+        throw std::runtime_error("FAIL: wrong ms conversion!!");
+    }
+    std::cout << " - OK!" << std::endl;
+
+    std::cout << " Check a pending overflow is accounted for.";
+    RTC.CNT = TIMER_TICKS_PER_SEC / 2;
+    RTC.INTFLAGS.value = RTC_OVF_bm;
+    prev = timer_get_ms();
+    rtc_cnt_vect_host();
+    if((prev != 64500) || (timer_get_ms() != prev))
+    {
+        throw std::runtime_error("FAIL: overflow not accounted for!!");
+    }
+    std::cout << " - OK!" << std::endl;
+
+    /* Past the 2^32 ticks wrap: ms keeps counting modulo 2^32. */
+    std::cout << " Check ms never goes back across the tick wrap.";
+    for(i = 0; i < 70000; i++)
+    {
+        RTC.INTFLAGS.value = RTC_OVF_bm;
+        rtc_cnt_vect_host();
+        if(timer_get_ms() - prev != 64000)
+        {
+            throw std::runtime_error("FAIL: ms discontinuity!!");
+        }
+        prev = timer_get_ms();
+    }
+    std::cout << " - OK!" << std::endl;
+    std::cout << std::endl;
+}
+
+/*!    \brief Verify channels not handed out by timer_channel_open can't be armed.
+**/
+void testChannelNotOpen(void)
+{
+    timer_channel_t ch;
+
+    std::cout << "  <<testChannelNotOpen>>" << std::endl;
+    timer_init();
+    std::cout << " Check an unopened channel is not armed.";
+    timer_channel_start_ticks(1, 10, false);
+    if(timer_channel_is_running(1))
+    {
+        throw std::runtime_error("FAIL: unopened channel armed!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    std::cout << " Check an opened channel is armed.";
+    ch = timer_channel_open(test_clbk);
+    timer_channel_start_ticks(ch, 10, false);
+    if(!timer_channel_is_running(ch) || timer_channel_is_running(ch + 1))
+    {
+        throw std::runtime_error("FAIL: wrong channel armed!!");
+    }
+    timer_channel_start_ticks(ch + 1, 10, false);
+    if(timer_channel_is_running(ch + 1))
+    {
+        throw std::runtime_error("FAIL: unopened channel armed!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    std::cout << std::endl;
+}
+
+/*!    \brief Verify timer_next_deadline reports the head of the expiry list.
+**/
+void testNextDeadline(void)
+{
+    timer_channel_t ch;
+
+    std::cout << "  <<testNextDeadline>>" << std::endl;
+    timer_init();
+    std::cout << " Check no deadline when no timer runs.";
+    if(timer_next_deadline() != TIMER_NO_DEADLINE)
+    {
+        throw std::runtime_error("FAIL: unexpected deadline!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    std::cout << " Check the earliest of system timer and channels.";
+    ch = timer_channel_open(test_clbk);
+    timer_start_one_shot_ms(100, test_clbk);
+    timer_channel_start_ticks(ch, 50, false);
+    RTC.CNT = 20;
+    if(timer_next_deadline() != 30)
+    {
+        throw std::runtime_error("FAIL: wrong deadline!!");
+    }
+    timer_channel_stop(ch);
+    if(timer_next_deadline() != 82)
+    {
+        throw std::runtime_error("FAIL: wrong deadline!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    std::cout << " Check an overdue deadline is 0.";
+    RTC.CNT = 200;
+    if(timer_next_deadline() != 0)
+    {
+        throw std::runtime_error("FAIL: overdue deadline not 0!!");
+    }
+    std::cout << " - OK!" << std::endl;
+    std::cout << std::endl;
+}
+
+int main(void)
+{
+    testNoStall();
+    testDeferredCommit();
+    testFlushBeforeSleep();
+    testEarlierWhileBusy();
+    testMilliseconds();
+    testChannelNotOpen();
+    testNextDeadline();
+}
+/****************************************************************/
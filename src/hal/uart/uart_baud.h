@@ -0,0 +1,160 @@
+/*!\file uart_baud.h
+** \author
+** \copyright TODO
+** \brief Baud rate planner for the megaavr USART.
+** \details The asynchronous USART divides the peripheral clock by a 16 bit
+**          fractional BAUD register (6 fractional bits), either in normal
+**          mode (16 samples per bit) or in double speed mode (CLK2X, 8
+**          samples per bit):
+**
+**          baud = 64 * f_clk / (S * BAUD), S = 16 (normal) or 8 (CLK2X),
+**          BAUD >= 64.
+**
+**          The planner evaluates both modes and keeps the one closest to the
+**          requested rate. Normal mode wins ties (errors are compared in
+**          0.01 % steps): it tolerates more noise.
+**          Double speed mode reaches f_clk / 8 (2 Mbaud at 16 MHz), normal
+**          mode stops at f_clk / 16.
+**
+**          Pure arithmetic, no register access: used by the core lib UART
+**          driver and host testable (see uart_baud_test.cpp).
+**/
+/****************************************************************/
+#ifndef __UART_BAUD_H
+#define __UART_BAUD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <inttypes.h>
+#include <stdbool.h>
+/****************************************************************/
+
+/*!\brief Smallest BAUD register value allowed in asynchronous mode.
+**/
+#define UART_BAUD_REG_MIN 64
+
+/*!\brief Selected baud rate setting.
+**/
+struct uart_baud_plan
+{
+    uint16_t reg;     /**< BAUD register value. */
+    bool clk2x;       /**< Double speed mode (CTRLB.RXMODE = CLK2X). */
+    uint32_t actual;  /**< Achieved baud rate. */
+    int16_t error_bp; /**< (actual - requested) / requested, in 0.01 %
+                           units (basis points). Saturates. */
+};
+
+/*!\brief Peripheral clock corrected with the factory calibration.
+**
+**    \param [in] f_cpu - nominal clock (F_CPU).
+**    \param [in] osc_error - signed oscillator error in 1/1024 of the
+**                            nominal frequency (SIGROW.OSC16ERR5V or
+**                            OSC16ERR3V, matching the supply).
+**
+**    \return corrected clock in Hz.
+**/
+static inline uint32_t uart_baud_clock(uint32_t f_cpu, int8_t osc_error)
+{
+    /* Split f_cpu: f_cpu * osc_error overflows 32 bit above 16 MHz. */
+    int32_t fix = (int32_t)(f_cpu / 1024) * osc_error +
+                  ((int32_t)(f_cpu % 1024) * osc_error) / 1024;
+
+    return (uint32_t)((int32_t)f_cpu + fix);
+}
+
+/*!\brief Evaluate one sampling mode.
+**
+**    \param [in] f_clk - peripheral clock in Hz.
+**    \param [in] baud - requested baud rate.
+**    \param [in] clk2x - double speed mode.
+**    \param [out] plan - setting, BAUD clamped to the valid range.
+**
+**    \return false if the BAUD register had to be clamped.
+**/
+static inline bool uart_baud_plan_mode(uint32_t f_clk, uint32_t baud, bool clk2x,
+                                       struct uart_baud_plan *plan)
+{
+    /* 64 / S: BAUD = k * f_clk / baud, actual = k * f_clk / BAUD. */
+    uint32_t k_clk = f_clk * (clk2x ? 8 : 4);
+    uint32_t reg = (k_clk + baud / 2) / baud;
+    bool valid = (reg >= UART_BAUD_REG_MIN) && (reg <= 0xFFFF);
+    int32_t diff;
+    int32_t error;
+
+    if(reg < UART_BAUD_REG_MIN)
+    {
+        reg = UART_BAUD_REG_MIN;
+    }
+    else if(reg > 0xFFFF)
+    {
+        reg = 0xFFFF;
+    }
+    plan->reg = (uint16_t)reg;
+    plan->clk2x = clk2x;
+    plan->actual = (k_clk + reg / 2) / reg;
+
+    /* Keep the product in 32 bit: coarser division for big errors
+     * (only clamped settings have them).
+     */
+    diff = (int32_t)(plan->actual - baud);
+    if((diff <= 200000) && (diff >= -200000))
+    {
+        error = diff * 10000 / (int32_t)baud;
+    }
+    else if(baud >= 10000)
+    {
+        error = diff / (int32_t)(baud / 10000);
+    }
+    else
+    {
+        error = diff;
+    }
+    if(error > INT16_MAX)
+    {
+        error = INT16_MAX;
+    }
+    else if(error < INT16_MIN)
+    {
+        error = INT16_MIN;
+    }
+    plan->error_bp = (int16_t)error;
+    return valid;
+}
+
+/*!\brief Pick the lowest error setting for a baud rate.
+**
+**    Settings within the BAUD register range always win over clamped ones.
+**
+**    \param [in] f_clk - peripheral clock in Hz (see uart_baud_clock).
+**    \param [in] baud - requested baud rate, not 0.
+**    \param [out] plan - selected setting. Filled in also on failure,
+**                        with the closest (clamped) setting.
+**
+**    \return false if the rate is out of reach (above f_clk / 8 or
+**            below 4 * f_clk / 65535).
+**/
+static inline bool uart_baud_plan(uint32_t f_clk, uint32_t baud, struct uart_baud_plan *plan)
+{
+    struct uart_baud_plan fast;
+    bool valid = uart_baud_plan_mode(f_clk, baud, false, plan);
+    bool fast_valid = uart_baud_plan_mode(f_clk, baud, true, &fast);
+    int32_t err = (plan->error_bp < 0) ? -(int32_t)plan->error_bp : plan->error_bp;
+    int32_t fast_err = (fast.error_bp < 0) ? -(int32_t)fast.error_bp : fast.error_bp;
+
+    if((fast_valid && !valid) || ((fast_valid == valid) && (fast_err < err)))
+    {
+        *plan = fast;
+        valid = fast_valid;
+    }
+    return valid;
+}
+
+/****************************************************************/
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UART_BAUD_H */
+/****************************************************************/
@@ -0,0 +1,161 @@
+/*!\file uart_baud_test.cpp
+** \author
+** \copyright
+** \brief Unit test for the baud rate planner in uart_baud.h
+** \details Table driven: each row is a clock, a requested rate and the
+**          expected setting. Build with:
+**          g++ uart_baud_test.cpp
+**/
+/****************************************************************/
+
+#include "uart_baud.h"
+#include<iostream>
+#include<stdexcept>
+/****************************************************************/
+
+/*!    \brief Expected plan for a clock and a baud rate.
+**/
+struct baudCase
+{
+    uint32_t f_clk;
+    uint32_t baud;
+    bool valid;
+    bool clk2x;
+    uint16_t reg;
+    uint32_t actual;
+    int16_t error_bp;
+};
+
+/** Standard and high rates at 16 MHz and 20 MHz. Out of reach rates
+ ** (300 baud, 2.5 Mbaud at 16 MHz) get the closest clamped setting.
+ **/
+static const baudCase cases[] =
+{
+    {16000000UL,     300UL, false, false, 65535,     977UL,  22566},
+    {16000000UL,    1200UL, true , false, 53333,    1200UL,      0},
+    {16000000UL,    9600UL, true , false,  6667,    9600UL,      0},
+    {16000000UL,   19200UL, true , true ,  6667,   19199UL,      0},
+    {16000000UL,   57600UL, true , false,  1111,   57606UL,      1},
+    {16000000UL,  115200UL, true , true ,  1111,  115212UL,      1},
+    {16000000UL,  230400UL, true , false,   278,  230216UL,     -7},
+    {16000000UL,  250000UL, true , false,   256,  250000UL,      0},
+    {16000000UL,  460800UL, true , false,   139,  460432UL,     -7},
+    {16000000UL,  500000UL, true , false,   128,  500000UL,      0},
+    {16000000UL,  921600UL, true , true ,   139,  920863UL,     -7},
+    {16000000UL, 1000000UL, true , false,    64, 1000000UL,      0},
+    {16000000UL, 1500000UL, true , true ,    85, 1505882UL,     39},
+    {16000000UL, 2000000UL, true , true ,    64, 2000000UL,      0},
+    {16000000UL, 2500000UL, false, true ,    64, 2000000UL,  -2000},
+    {20000000UL,     300UL, false, false, 65535,    1221UL,  30700},
+    {20000000UL,    1200UL, false, false, 65535,    1221UL,    175},
+    {20000000UL,    9600UL, true , false,  8333,    9600UL,      0},
+    {20000000UL,   19200UL, true , true ,  8333,   19201UL,      0},
+    {20000000UL,   57600UL, true , false,  1389,   57595UL,      0},
+    {20000000UL,  115200UL, true , true ,  1389,  115191UL,      0},
+    {20000000UL,  230400UL, true , false,   347,  230548UL,      6},
+    {20000000UL,  250000UL, true , false,   320,  250000UL,      0},
+    {20000000UL,  460800UL, true , true ,   347,  461095UL,      6},
+    {20000000UL,  500000UL, true , false,   160,  500000UL,      0},
+    {20000000UL,  921600UL, true , false,    87,  919540UL,    -22},
+    {20000000UL, 1000000UL, true , false,    80, 1000000UL,      0},
+    {20000000UL, 1500000UL, true , true ,   107, 1495327UL,    -31},
+    {20000000UL, 2000000UL, true , true ,    80, 2000000UL,      0},
+    {20000000UL, 2500000UL, true , true ,    64, 2500000UL,      0},
+};
+
+/*!    \brief Check the planner against the table.
+**
+** Also check the invariants of every row: the achieved rate follows from
+** the register and the mode, settings are within the register range when
+** valid.
+**/
+void testPlanTable(void)
+{
+    std::cout << "  <<testPlanTable>>" << std::endl;
+    for(auto &c : cases)
+    {
+        struct uart_baud_plan plan;
+        bool valid = uart_baud_plan(c.f_clk, c.baud, &plan);
+        uint32_t samples = plan.clk2x ? 8 : 16;
+        uint32_t expected_actual = (64 * (uint64_t)c.f_clk + samples * plan.reg / 2) / (samples * plan.reg);
+
+        std::cout << " f=" << c.f_clk << " baud=" << c.baud << ": "
+                  << (plan.clk2x ? "CLK2X" : "normal") << " BAUD=" << plan.reg
+                  << " actual=" << plan.actual << " error=" << plan.error_bp << "bp";
+        if((valid != c.valid) || (plan.clk2x != c.clk2x) || (plan.reg != c.reg) ||
+           (plan.actual != c.actual) || (plan.error_bp != c.error_bp))
+        {
+            std::cout << " - FAIL!!!" << std::endl;
+            throw std::runtime_error("FAIL: unexpected baud plan!");
+        }
+        if((plan.actual != expected_actual) || (valid && (plan.reg < UART_BAUD_REG_MIN)))
+        {
+            std::cout << " - FAIL!!!" << std::endl;
+            throw std::runtime_error("FAIL: inconsistent baud plan!");
+        }
+        std::cout << " - OK!" << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+/*!    \brief Valid settings stay within 1 % up to f_clk / 8.
+**/
+void testErrorBound(void)
+{
+    std::cout << "  <<testErrorBound>>" << std::endl;
+    std::cout << " Check |error| < 1 % from 1200 baud to 2 Mbaud at 16 MHz.";
+    for(uint32_t baud = 1200; baud <= 2000000; baud += 997)
+    {
+        struct uart_baud_plan plan;
+
+        if(!uart_baud_plan(16000000UL, baud, &plan) || (plan.error_bp >= 100) || (plan.error_bp <= -100))
+        {
+            std::cout << " - FAIL!!! baud=" << baud << std::endl;
+            throw std::runtime_error("FAIL: baud error out of bounds!");
+        }
+    }
+    std::cout << " - OK!" << std::endl;
+    std::cout << std::endl;
+}
+
+/*!    \brief Clock correction with the factory calibration.
+**/
+void testClock(void)
+{
+    static const struct
+    {
+        uint32_t f_cpu;
+        int8_t osc_error;
+        uint32_t expected;
+    } clocks[] =
+    {
+        {16000000UL,    0, 16000000UL},
+        {16000000UL,    1, 16015625UL},
+        {16000000UL, -128, 14000000UL},
+        {20000000UL,  127, 22480468UL},
+        {20000000UL,   -3, 19941407UL},
+    };
+
+    std::cout << "  <<testClock>>" << std::endl;
+    for(auto &c : clocks)
+    {
+        uint32_t f = uart_baud_clock(c.f_cpu, c.osc_error);
+
+        std::cout << " f_cpu=" << c.f_cpu << " error=" << (int)c.osc_error << ": " << f;
+        if(f != c.expected)
+        {
+            std::cout << " - FAIL!!!" << std::endl;
+            throw std::runtime_error("FAIL: wrong corrected clock!");
+        }
+        std::cout << " - OK!" << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+int main(void)
+{
+    testPlanTable();
+    testErrorBound();
+    testClock();
+}
+/****************************************************************/
@@ -8,27 +8,198 @@
 
 #include "watchdog.h"
 #include "watchdog_config.h"
+#include "interrupts.h"
+#include "timer.h"
+#ifdef WATCHDOG_EARLY_WARNING
+#include "pit.h"
+#include "pit_config.h"
+#endif
 #include <stddef.h>
+#include <avr/interrupt.h>
 #include <avr/wdt.h>
 /****************************************************************/
 
+/* Checkpoint timeouts are measured on timer_get_tick(): it has to be
+ * monotonic.
+ */
+#ifndef TIMER_FREE_RUNNING
+#error "watchdog checkpoints require TIMER_FREE_RUNNING (see timer_config.h)"
+#endif
+
+struct watchdog_checkpoint_state
+{
+    uint32_t timeout;      /** Maximum ticks between two check-ins. */
+    uint32_t last_checkin; /** Tick of the last check-in. */
+};
+
+/** Checkpoints can't be unregistered, so we can just use an array and an
+ ** index to the first invalid element.
+ **/
+static struct watchdog_checkpoint_state checkpoints[WATCHDOG_MAX_CHECKPOINTS];
+static uint8_t checkpoints_first_invalid = 0;
+
+/** Record of the late checkpoint. It is preserved on reboot so that it can
+ ** be read after the watchdog reset. The complement guards against
+ ** the random content of the RAM at power on.
+ **/
+struct watchdog_culprit_record
+{
+    watchdog_checkpoint_t cp;
+    watchdog_checkpoint_t cp_complement;
+};
+static struct watchdog_culprit_record culprit_record __attribute__ ((section (".noinit")));
+
+/** Culprit of the last reset, read from culprit_record at boot. */
+static watchdog_checkpoint_t last_culprit = WATCHDOG_CHECKPOINT_NONE;
+
+#ifdef WATCHDOG_EARLY_WARNING
+/** Watchdog timeout, margin and periodic tick period in 32.768kHz
+ ** cycles (watchdog runs from the 1.024kHz ULP oscillator).
+ **/
+#define WATCHDOG_TIMEOUT_CYCLES ((4UL << (WATCHDOG_TIMEOUT >> WDT_PERIOD_gp)) * 32UL)
+#define WATCHDOG_MARGIN_CYCLES (((uint32_t)WATCHDOG_EARLY_WARNING_MARGIN_MS * 32768UL) / 1000UL)
+#define WATCHDOG_PIT_CYCLES (2UL << (PIT_PERIOD >> RTC_PERIOD_gp))
+
+/** Periodic ticks without a kick before warning. The warning is issued
+ ** on the next tick, up to (WATCHDOG_EARLY_WARNING_PIT_TICKS + 1)
+ ** periods after the kick.
+ **/
+#define WATCHDOG_EARLY_WARNING_PIT_TICKS \
+    ((WATCHDOG_TIMEOUT_CYCLES - WATCHDOG_MARGIN_CYCLES) / WATCHDOG_PIT_CYCLES - 1)
+
+_Static_assert(WATCHDOG_TIMEOUT_CYCLES >= WATCHDOG_MARGIN_CYCLES + 2 * WATCHDOG_PIT_CYCLES,
+               "WATCHDOG_EARLY_WARNING_MARGIN_MS leaves less than 2 PIT_PERIOD before WATCHDOG_TIMEOUT");
+_Static_assert(WATCHDOG_EARLY_WARNING_PIT_TICKS < UINT8_MAX,
+               "PIT_PERIOD too short for WATCHDOG_TIMEOUT: early warning tick count overflows");
+
+/** Early warning callback. */
+static volatile watchdog_warning_t early_warning = NULL;
+/** Periodic ticks since the last hardware kick. */
+static volatile uint8_t ticks_since_kick = 0;
+
+/** Periodic tick callback: count ticks since last kick and warn once. */
+static void watchdog_on_pit_tick(void)
+{
+    watchdog_warning_t clbk = early_warning;
+
+    if(ticks_since_kick > WATCHDOG_EARLY_WARNING_PIT_TICKS)
+    {
+        /* Already warned. */
+        return;
+    }
+    if((++ticks_since_kick > WATCHDOG_EARLY_WARNING_PIT_TICKS) && (clbk != NULL))
+    {
+        (*clbk)(culprit_record.cp);
+    }
+}
+#endif /* WATCHDOG_EARLY_WARNING */
+
+/** Store the culprit in the preserved RAM */
+static void watchdog_record_culprit(watchdog_checkpoint_t cp)
+{
+    culprit_record.cp = cp;
+    culprit_record.cp_complement = (watchdog_checkpoint_t)~cp;
+}
+
 /* AVR libc provides a wdt_enable but it doesn't seem to fully support
  * all the features and timeout values. Better to DIY.
  */
 void watchdog_init(void)
 {
-    /* Enable watchdog by programming the timeout */
-    _PROTECTED_WRITE(WDT.CTRLA, WATCHDOG_TIMEOUT);
+    /* Read out the culprit of the last reset and clear it. */
+    if((watchdog_checkpoint_t)(culprit_record.cp ^ culprit_record.cp_complement) == 0xFF)
+    {
+        last_culprit = culprit_record.cp;
+    }
+    watchdog_record_culprit(WATCHDOG_CHECKPOINT_NONE);
+#ifdef WATCHDOG_EARLY_WARNING
+    pit_subscribe(watchdog_on_pit_tick, 1);
+#endif
+    /* Enable watchdog by programming the timeout and the closed window */
+    _PROTECTED_WRITE(WDT.CTRLA, WATCHDOG_WINDOW | WATCHDOG_TIMEOUT);
     /* Wait for the setting to be written (just in case) */
     while(WDT.STATUS & WDT_SYNCBUSY_bm);
     /* Lock the watchdog to protect it from accidental writing */
     _PROTECTED_WRITE(WDT.STATUS, WDT_LOCK_bm);
 }
 
-/* This can happily wrap avr macro to call asm("WDT") */
+/* Hardware kick can happily wrap avr macro to call asm("WDT") */
 void watchdog_kick(void)
 {
+    uint8_t i;
+    interrupts_state_t sreg;
+    uint32_t now;
+    bool late;
+
+    if(culprit_record.cp != WATCHDOG_CHECKPOINT_NONE)
+    {
+        /* Already waiting for the reset. */
+        return;
+    }
+    for(i = 0; i < checkpoints_first_invalid; i++)
+    {
+        /* Read the tick with the check-in: an ISR checking in between
+         * would put last_checkin after now. The signed difference keeps
+         * a check-in racing timer_get_tick on time anyway.
+         */
+        sreg = interrupts_save_off();
+        now = timer_get_tick();
+        late = (int32_t)(now - checkpoints[i].last_checkin) > (int32_t)checkpoints[i].timeout;
+        interrupts_restore(sreg);
+        if(late)
+        {
+            /* Stop kicking: hardware watchdog will reset the system. */
+            watchdog_record_culprit(i);
+            return;
+        }
+    }
     wdt_reset();
+#ifdef WATCHDOG_EARLY_WARNING
+    ticks_since_kick = 0;
+#endif
+}
+
+watchdog_checkpoint_t watchdog_checkpoint_register(uint16_t timeout_ms)
+{
+    struct watchdog_checkpoint_state *c;
+
+    if(checkpoints_first_invalid >= WATCHDOG_MAX_CHECKPOINTS)
+    {
+        return WATCHDOG_CHECKPOINT_NONE;
+    }
+    c = &checkpoints[checkpoints_first_invalid];
+    c->timeout = ((uint32_t)timeout_ms * TIMER_TICKS_PER_SEC + 999) / 1000;
+    c->last_checkin = timer_get_tick();
+    return checkpoints_first_invalid++;
+}
+
+void watchdog_checkpoint(watchdog_checkpoint_t cp)
+{
+    uint32_t now;
+    interrupts_state_t sreg;
+
+    if(cp >= checkpoints_first_invalid)
+    {
+        return;
+    }
+    now = timer_get_tick();
+    sreg = interrupts_save_off();
+    checkpoints[cp].last_checkin = now;
+    interrupts_restore(sreg);
+}
+
+watchdog_checkpoint_t watchdog_read_culprit(void)
+{
+    return last_culprit;
+}
+
+void watchdog_set_early_warning(watchdog_warning_t clbk)
+{
+#ifdef WATCHDOG_EARLY_WARNING
+    early_warning = clbk;
+#else
+    (void)clbk;
+#endif
 }
 
 /****************************************************************/
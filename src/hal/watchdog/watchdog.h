@@ -6,6 +6,11 @@
 **         Watchdog timers are protection mechanisms that allow the system to
 **         recover from erroneous software conditions such as deadlocks or
 **         runaway code. It does so by issuing a reset at expiration.
+**
+**         The hardware watchdog is shared by several liveness sources
+**         (checkpoints), i.e. dispatcher tasks or event handlers. Each
+**         checkpoint has its own timeout and the hardware watchdog is
+**         only serviced while all of them check in on time.
 **/
 /****************************************************************/
 #ifndef __WATCHDOG_H
@@ -21,7 +26,9 @@ extern "C" {
 
 /*!    \brief Initialise watchdog timer.
 **
-**    Call at boot to perform hardware setup.
+**    Call at boot to perform hardware setup. Timeout and windowed mode
+**    are configured in watchdog_config.h.
+**    If early warning is enabled, call after pit_init().
 **
 **    \return None
 **/
@@ -32,9 +39,81 @@ void watchdog_init(void);
 **    Call this function regularly to clear the watchdog counter and
 **    prevent system reset.
 **
+**    The watchdog counter is only cleared if all the registered
+**    checkpoints checked in within their timeout. Otherwise, the
+**    first late checkpoint is recorded (see watchdog_read_culprit)
+**    and the hardware watchdog is left to expire.
+**
 **    \return None
 **/
 void watchdog_kick(void);
+
+/*!    \brief Type for watchdog checkpoints.
+**/
+typedef uint8_t watchdog_checkpoint_t;
+
+/*!    \brief Invalid checkpoint.
+**
+** Returned by watchdog_checkpoint_register on failure and by
+** watchdog_read_culprit when the last reset was not caused by a late
+** checkpoint.
+**/
+#define WATCHDOG_CHECKPOINT_NONE 0xFF
+
+/*!    \brief Register a liveness checkpoint.
+**
+** Checkpoints can't be unregistered (see WATCHDOG_MAX_CHECKPOINTS in
+** watchdog_config.h). A checkpoint is considered alive at registration.
+**
+**    \param [in] timeout_ms - maximum time between two check-ins.
+**
+**    \return Checkpoint ID to use with watchdog_checkpoint.
+**            WATCHDOG_CHECKPOINT_NONE if no more checkpoints are available.
+**/
+watchdog_checkpoint_t watchdog_checkpoint_register(uint16_t timeout_ms);
+
+/*!    \brief Check in a liveness checkpoint.
+**
+** Call from the code to monitor (i.e. at the end of a dispatcher task).
+** Safe to call from interrupt context.
+**
+**    \param [in] cp - checkpoint returned by watchdog_checkpoint_register.
+**
+**    \return None
+**/
+void watchdog_checkpoint(watchdog_checkpoint_t cp);
+
+/*!    \brief Read the checkpoint that caused the last reset.
+**
+** Shall be called after watchdog_init().
+**
+**    \return ID of the checkpoint that failed to check in before the last
+**            watchdog reset. WATCHDOG_CHECKPOINT_NONE if the last reset was
+**            not caused by a late checkpoint.
+**/
+watchdog_checkpoint_t watchdog_read_culprit(void);
+
+/*!    \brief Type for watchdog early warning callback.
+**
+**    \param [in] culprit - first late checkpoint, WATCHDOG_CHECKPOINT_NONE
+**                          if the watchdog is not serviced at all.
+**/
+typedef void (*watchdog_warning_t)(watchdog_checkpoint_t culprit);
+
+/*!    \brief Set the early warning callback.
+**
+** The callback is called once when the watchdog has not been serviced
+** for most of WATCHDOG_TIMEOUT, at least WATCHDOG_EARLY_WARNING_MARGIN_MS
+** before the hardware reset (see watchdog_config.h). It can be used to
+** flush logs and capture the system state. It runs in interrupt context
+** and shall not rely on other interrupts.
+** Does nothing unless WATCHDOG_EARLY_WARNING is defined.
+**
+**    \param [in] clbk - callback to execute. NULL to disable.
+**
+**    \return None
+**/
+void watchdog_set_early_warning(watchdog_warning_t clbk);
 /****************************************************************/
 #ifdef __cplusplus
 }
@@ -36,6 +36,52 @@ extern "C" {
 **/
 #define WATCHDOG_TIMEOUT WDT_PERIOD_8KCLK_gc
 
+/*!    \brief Watchdog closed window period.
+**
+** In windowed mode, servicing the watchdog before the closed window
+** period has elapsed since the previous kick issues a reset too:
+** it catches runaway loops that kick too often.
+** Can be any of the following labels (see WDT_WINDOW_t in avr/io.h):
+**
+** WDT_WINDOW_OFF_gc => Off (normal mode)
+** WDT_WINDOW_8CLK_gc => 8 cycles (8ms)
+** WDT_WINDOW_16CLK_gc => 16 cycles (16ms)
+** WDT_WINDOW_32CLK_gc => 32 cycles (32ms)
+** WDT_WINDOW_64CLK_gc => 64 cycles (64ms)
+** WDT_WINDOW_128CLK_gc => 128 cycles (0.128s)
+** WDT_WINDOW_256CLK_gc => 256 cycles (0.256s)
+** WDT_WINDOW_512CLK_gc => 512 cycles (0.512s)
+** WDT_WINDOW_1KCLK_gc => 1K cycles (1.0s)
+** WDT_WINDOW_2KCLK_gc => 2K cycles (2.0s)
+** WDT_WINDOW_4KCLK_gc => 4K cycles (4.1s)
+** WDT_WINDOW_8KCLK_gc => 8K cycles (8.2s)
+**/
+#define WATCHDOG_WINDOW WDT_WINDOW_OFF_gc
+
+/*!    \brief Enable early warning.
+**
+** If defined, the callback set with watchdog_set_early_warning is called
+** when the watchdog is about to expire. Early warning is driven by the
+** periodic tick (see pit.h) which keeps running in all sleep modes.
+**/
+#define WATCHDOG_EARLY_WARNING
+
+/*!    \brief Early warning margin in ms.
+**
+** Minimum time left to the early warning callback before the watchdog
+** reset. The number of periodic ticks to wait (see PIT_PERIOD in
+** pit_config.h) is derived from it and from WATCHDOG_TIMEOUT: the
+** warning comes at most one period earlier than needed.
+**/
+#define WATCHDOG_EARLY_WARNING_MARGIN_MS 500
+
+/*!    \brief Maximum number of checkpoints
+**
+** This is the maximum number of checkpoints that can be registered
+** using watchdog_checkpoint_register(...) API.
+**/
+#define WATCHDOG_MAX_CHECKPOINTS 4
+
 /****************************************************************/
 #ifdef __cplusplus
 }
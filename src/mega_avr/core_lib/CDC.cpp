@@ -23,9 +23,18 @@
 #include "api/USBAPI.h"
 #include "USBCore.h"
 #include "api/Common.h"
+#include "SpscRing.h"
 
 #if defined(USBCON)
 
+// Transmit aggregation: write() only fills this ring, full packets go to
+// the endpoint right away, the remainder at the next start of frame (1 ms).
+#ifndef CDC_TX_BUFFER_SIZE
+#define CDC_TX_BUFFER_SIZE (2 * USB_EP_SIZE)
+#endif
+// Give up on a full buffer the host doesn't drain (port not read).
+#define CDC_TX_TIMEOUT_MS 250
+
 typedef struct
 {
 	uint32_t	dwDTERate;
@@ -40,6 +49,8 @@ static volatile int32_t breakValue = -1;
 
 static uint8_t wdtcsr_save;
 
+static SpscRing<CDC_TX_BUFFER_SIZE> _cdcTx;
+
 #define WEAK __attribute__ ((weak))
 
 extern const CDCDescriptor _cdcInterface PROGMEM;
@@ -167,6 +178,37 @@ bool CDC_Setup(USBSetup& setup)
 	return false;
 }
 
+// Move buffered bytes to the IN endpoint bank, as much as it takes.
+// Called from both the sketch and the USB ISR: the consumer side runs
+// with interrupts off. Returns the number of bytes moved.
+static size_t CDC_Drain(void)
+{
+	size_t done = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		for (;;) {
+			size_t len;
+			const uint8_t* data = _cdcTx.readSpan(len);
+
+			if (len == 0)
+				break;
+			if (len > USB_EP_SIZE)
+				len = USB_EP_SIZE;
+			uint8_t n = USB_SendBank(CDC_TX, data, len);
+			if (n == 0)
+				break;
+			_cdcTx.consume(n);
+			done += n;
+		}
+	}
+	return done;
+}
+
+void CDC_StartOfFrame(void)
+{
+	if (!_cdcTx.empty())
+		CDC_Drain();
+}
 
 void Serial_::begin(unsigned long /* baud_count */)
 {
@@ -207,13 +249,47 @@ int Serial_::read(void)
 	return USB_Recv(CDC_RX);
 }
 
+// Bulk read: whole endpoint banks per call instead of one USB_Recv()
+// per byte. Same timeout as Stream::readBytes(): between two chunks.
+size_t Serial_::readBytes(char *buffer, size_t length)
+{
+	size_t count = 0;
+	unsigned long start = millis();
+
+	if (length && peek_buffer >= 0) {
+		buffer[count++] = peek_buffer;
+		peek_buffer = -1;
+	}
+	while (count < length) {
+		// Two banks at most: bounds the time spent with interrupts off.
+		int chunk = min(length - count, (size_t)(2 * USB_EP_SIZE));
+		int n = USB_Recv(CDC_RX, buffer + count, chunk);
+
+		if (n > 0) {
+			count += n;
+			start = millis();
+		} else if (n < 0 || millis() - start >= _timeout) {
+			break;
+		}
+	}
+	return count;
+}
+
 int Serial_::availableForWrite(void)
 {
-	return USB_SendSpace(CDC_TX);
+	return _cdcTx.availableForWrite();
 }
 
 void Serial_::flush(void)
 {
+	unsigned long start = millis();
+
+	while (!_cdcTx.empty()) {
+		if (CDC_Drain() != 0)
+			start = millis();
+		else if (millis() - start > CDC_TX_TIMEOUT_MS)
+			break;
+	}
 	USB_Flush(CDC_TX);
 }
 
@@ -234,9 +310,26 @@ size_t Serial_::write(const uint8_t *buffer, size_t size)
 	// open connection isn't broken cleanly (cable is yanked out, host dies
 	// or locks up, or host virtual serial port hangs)
 	if (_usbLineInfo.lineState > 0)	{
-		int r = USB_Send(CDC_TX,buffer,size);
-		if (r > 0) {
-			return r;
+		size_t done = 0;
+		unsigned long start = millis();
+
+		while (done < size) {
+			size_t n = _cdcTx.write(buffer + done, size - done);
+
+			done += n;
+			// Full packets don't wait for the start of frame.
+			if (_cdcTx.available() >= USB_EP_SIZE || done < size)
+				n += CDC_Drain();
+			if (n != 0) {
+				start = millis();
+			} else if (millis() - start > CDC_TX_TIMEOUT_MS) {
+				break;
+			} else {
+				delay(1);
+			}
+		}
+		if (done > 0) {
+			return done;
 		} else {
 			setWriteError();
 			return 0;
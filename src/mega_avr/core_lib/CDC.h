@@ -37,6 +37,8 @@ public:
 	virtual int available(void);
 	virtual int peek(void);
 	virtual int read(void);
+	size_t readBytes(char *buffer, size_t length);
+	size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
 	virtual int availableForWrite(void);
 	virtual void flush(void);
 	virtual size_t write(uint8_t);
@@ -97,6 +99,7 @@ extern Serial_ Serial;
 int		CDC_GetInterface(uint8_t* interfaceNum);
 int		CDC_GetDescriptor(int i);
 bool	CDC_Setup(USBSetup& setup);
+void	CDC_StartOfFrame(void);
 
 #endif
 
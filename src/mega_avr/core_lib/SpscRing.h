@@ -0,0 +1,248 @@
+/*!\file SpscRing.h
+** \author
+** \copyright TODO
+** \brief Single producer, single consumer byte ring buffer.
+** \details One side only writes (i.e. a receive ISR), the other only reads
+**          (i.e. the main loop): each side owns one index, so no lock is
+**          needed. The size is a power of 2 (indices wrap with a mask) and
+**          one slot is kept empty to tell a full ring from an empty one:
+**          a SpscRing<N> holds N - 1 bytes.
+**
+**          Indices are 8 bit up to 256 bytes. Wider indices are read and
+**          written with interrupts off, so that the other side never sees
+**          half an update.
+**
+**          Besides byte access, both sides can work on the largest
+**          contiguous span (writeSpan/commit, readSpan/consume): at most
+**          two spans per trip around the ring.
+**/
+/****************************************************************/
+#ifndef __SPSC_RING_H
+#define __SPSC_RING_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+#include <util/atomic.h>
+/****************************************************************/
+
+// Smallest index type able to address a ring of a given size.
+template <bool WIDE> struct SpscRingIndexSelect { typedef uint8_t type; };
+template <> struct SpscRingIndexSelect<true> { typedef uint16_t type; };
+
+// Index access from either side: atomic for 16 bit indices, byte wide
+// indices need no guard. Either way the compiler barrier keeps the
+// (non volatile) buffer accesses on the right side of the index: after
+// the load (acquire), before the store (publish). ATOMIC_BLOCK already
+// implies one.
+static inline uint8_t spsc_index_load(const volatile uint8_t &index)
+{
+  uint8_t value = index;
+
+  __asm__ __volatile__("" ::: "memory");
+  return value;
+}
+
+static inline uint16_t spsc_index_load(const volatile uint16_t &index)
+{
+  uint16_t value;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    value = index;
+  }
+  return value;
+}
+
+static inline void spsc_index_store(volatile uint8_t &index, uint8_t value)
+{
+  __asm__ __volatile__("" ::: "memory");
+  index = value;
+}
+
+static inline void spsc_index_store(volatile uint16_t &index, uint16_t value)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    index = value;
+  }
+}
+
+template <size_t N>
+class SpscRing
+{
+  static_assert((N >= 2) && (N <= 32768) && ((N & (N - 1)) == 0),
+                "SpscRing size must be a power of 2 between 2 and 32768");
+
+  public:
+    typedef typename SpscRingIndexSelect<(N > 256)>::type index_t;
+    static const index_t MASK = N - 1;
+
+    SpscRing(void) : _head(0), _tail(0) {}
+
+    // Either side //////////////////////////////////////////////////////////
+
+    // Bytes waiting to be read.
+    size_t available(void) const
+    {
+      return (index_t)(spsc_index_load(_head) - spsc_index_load(_tail)) & MASK;
+    }
+    // Room left for the producer.
+    size_t availableForWrite(void) const
+    {
+      return (index_t)(spsc_index_load(_tail) - spsc_index_load(_head) - 1) & MASK;
+    }
+    bool empty(void) const
+    {
+      return spsc_index_load(_head) == spsc_index_load(_tail);
+    }
+
+    // Producer side ////////////////////////////////////////////////////////
+
+    // Store a byte. Returns false (and drops it) if the ring is full.
+    bool push(uint8_t c)
+    {
+      index_t head = _head;
+      index_t next = (head + 1) & MASK;
+
+      if (next == spsc_index_load(_tail)) {
+        return false;
+      }
+      _buffer[head] = c;
+      spsc_index_store(_head, next);
+      return true;
+    }
+    // Largest contiguous free span: fill up to len bytes, then commit().
+    uint8_t *writeSpan(size_t &len)
+    {
+      index_t head = _head;
+      index_t tail = spsc_index_load(_tail);
+
+      if (head >= tail) {
+        // Free up to the end of the buffer, keeping one slot empty
+        // if the tail is at the start.
+        len = N - head - (tail == 0 ? 1 : 0);
+      } else {
+        len = tail - head - 1;
+      }
+      return &_buffer[head];
+    }
+    // Publish len bytes filled through writeSpan().
+    void commit(size_t len)
+    {
+      spsc_index_store(_head, (index_t)((_head + len) & MASK));
+    }
+    // Copy as many bytes as fit, returns the number copied.
+    size_t write(const uint8_t *data, size_t len)
+    {
+      size_t done = 0;
+
+      while (done < len) {
+        size_t span;
+        uint8_t *dst = writeSpan(span);
+
+        if (span == 0) {
+          break;
+        }
+        if (span > len - done) {
+          span = len - done;
+        }
+        memcpy(dst, data + done, span);
+        commit(span);
+        done += span;
+      }
+      return done;
+    }
+
+    // Consumer side ////////////////////////////////////////////////////////
+
+    // Take the oldest byte. Returns false if the ring is empty.
+    bool pop(uint8_t &c)
+    {
+      index_t tail = _tail;
+
+      if (spsc_index_load(_head) == tail) {
+        return false;
+      }
+      c = _buffer[tail];
+      spsc_index_store(_tail, (index_t)((tail + 1) & MASK));
+      return true;
+    }
+    // Oldest byte, -1 if none.
+    int read(void)
+    {
+      uint8_t c;
+
+      return pop(c) ? c : -1;
+    }
+    int peek(void) const
+    {
+      index_t tail = _tail;
+
+      if (spsc_index_load(_head) == tail) {
+        return -1;
+      }
+      return _buffer[tail];
+    }
+    // Largest contiguous span of received bytes: use up to len bytes in
+    // place, then consume().
+    const uint8_t *readSpan(size_t &len) const
+    {
+      index_t head = spsc_index_load(_head);
+      index_t tail = _tail;
+
+      len = (head >= tail) ? head - tail : N - tail;
+      return &_buffer[tail];
+    }
+    // Give len bytes obtained through readSpan() back to the producer.
+    void consume(size_t len)
+    {
+      spsc_index_store(_tail, (index_t)((_tail + len) & MASK));
+    }
+    // Copy up to len bytes out, returns the number copied.
+    size_t read(uint8_t *data, size_t len)
+    {
+      size_t done = 0;
+
+      while (done < len) {
+        size_t span;
+        const uint8_t *src = readSpan(span);
+
+        if (span == 0) {
+          break;
+        }
+        if (span > len - done) {
+          span = len - done;
+        }
+        memcpy(data + done, src, span);
+        consume(span);
+        done += span;
+      }
+      return done;
+    }
+    // Drop everything received so far.
+    void clear(void)
+    {
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        _tail = _head;
+      }
+    }
+
+    // Raw positions, for layers that keep records in the ring (i.e. UART
+    // frame mode). Positions are indices in [0, N).
+
+    index_t head(void) const { return spsc_index_load(_head); }
+    index_t tail(void) const { return spsc_index_load(_tail); }
+    const uint8_t *at(index_t index) const { return &_buffer[index]; }
+    // Producer: take back the bytes stored from position head on (not
+    // read yet by the consumer).
+    void rewind(index_t head) { spsc_index_store(_head, head); }
+    // Consumer: release the bytes up to position tail.
+    void release(index_t tail) { spsc_index_store(_tail, tail); }
+
+  private:
+    volatile index_t _head;
+    volatile index_t _tail;
+    uint8_t _buffer[N];
+};
+
+#endif /* __SPSC_RING_H */
+/****************************************************************/
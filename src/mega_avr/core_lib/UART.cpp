@@ -26,9 +26,13 @@
 #include <inttypes.h>
 #include <util/atomic.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include "Arduino.h"
 
 #include "UART.h"
+#include "interrupts.h"
+#include "uart_baud.h"
+#include "sleep.h"
 #include "UART_private.h"
 
 // this next line disables the entire UART.cpp,
@@ -60,6 +64,11 @@ void serialEvent3() __attribute__((weak));
 bool Serial3_available() __attribute__((weak));
 #endif
 
+// The power manager (hal/sleep) is only linked in by the targets using
+// it: without it there are no constraints to declare.
+extern "C" void sleep_constraint_set(sleep_mode_t deepest) __attribute__((weak));
+extern "C" void sleep_constraint_release(sleep_mode_t deepest) __attribute__((weak));
+
 void serialEventRun(void)
 {
 #if defined(HAVE_HWSERIAL0)
@@ -76,63 +85,88 @@ void serialEventRun(void)
 #endif
 }
 
-// macro to guard critical sections when needed for large TX buffer sizes
-#if (SERIAL_TX_BUFFER_SIZE > 256)
-#define TX_BUFFER_ATOMIC ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-#else
-#define TX_BUFFER_ATOMIC
-#endif
+// Check if we are inside an ISR already (could be from by a source other than UART),
+// in which case the UART ISRs will be blocked. Temporarily elevate the DRE
+// interrupt to allow it to run.
+void UartClass::_elevate_dre_interrupt(void)
+{
+    //Don't elevate twice: the vector to restore would be lost.
+    if((interrupts_execution_level() == interrupts_level_0) && !_hwserial_dre_interrupt_elevated) {
+        //Elevate the priority level of the Data Register Empty Interrupt vector
+        //and copy whatever vector number that might be in the register already.
+        _prev_lvl1_interrupt_vect = interrupts_priority_swap(_hwserial_dre_interrupt_vect_num);
 
-// Actual interrupt handlers //////////////////////////////////////////////////////////////
+        _hwserial_dre_interrupt_elevated = 1;
+    }
+}
 
-void UartClass::_tx_data_empty_irq(void)
+// Move to the next descriptor and complete the current one. The queue is
+// consistent before the callback runs: it can queue a new chain.
+// The link is cleared, so that a completed descriptor can be queued again
+// without taking along whatever was appended to it.
+void UartClass::_tx_chain_pop(UartTxDescriptor *desc)
 {
-    // Check if tx buffer already empty.
-    if (_tx_buffer_head == _tx_buffer_tail) {
-        // Buffer empty, so disable "data register empty" interrupt
-        (*_hwserial_module).CTRLA &= (~USART_DREIE_bm);
-        return;
+    _tx_chain_offset = 0;
+    _tx_chain_head = desc->next;
+    desc->next = NULL;
+    if (_tx_chain_head == NULL) {
+        _tx_chain_tail = NULL;
+    }
+    if (desc->complete != NULL) {
+        desc->complete(desc);
     }
+}
 
-    // There must be more data in the output
-    // buffer. Send the next byte
-    unsigned char c = _tx_buffer[_tx_buffer_tail];
-    _tx_buffer_tail = (_tx_buffer_tail + 1) % SERIAL_TX_BUFFER_SIZE;
+// Send the next byte of the descriptor chain, called by the DRE ISR once
+// the ring buffer is empty. Returns false if there's nothing to send.
+bool UartClass::_tx_chain_irq(void)
+{
+    UartTxDescriptor *desc = _tx_chain_head;
 
-    // clear the TXCIF flag -- "can be cleared by writing a one to its bit
-    // location". This makes sure flush() won't return until the bytes
-    // actually got written
-    (*_hwserial_module).STATUS = USART_TXCIF_bm;
+    // Skip (and complete) empty descriptors.
+    while ((desc != NULL) && (desc->length == 0)) {
+        _tx_chain_pop(desc);
+        desc = _tx_chain_head;
+    }
+    if (desc == NULL) {
+        return false;
+    }
 
+    const uint8_t *p = desc->data + _tx_chain_offset;
+    unsigned char c = desc->progmem ? pgm_read_byte(p) : *p;
+
+    // clear the TXCIF flag: see _tx_data_empty_irq
+    (*_hwserial_module).STATUS = USART_TXCIF_bm;
     (*_hwserial_module).TXDATAL = c;
 
-    if (_tx_buffer_head == _tx_buffer_tail) {
-        // Buffer empty, so disable "data register empty" interrupt
-        (*_hwserial_module).CTRLA &= (~USART_DREIE_bm);
+    if (++_tx_chain_offset == desc->length) {
+        _tx_chain_pop(desc);
+    }
+    return true;
+}
 
-        //Take the DRE interrupt back no normal priority level if it has been elevated
-        if(_hwserial_dre_interrupt_elevated) {
-            CPUINT.LVL1VEC = _prev_lvl1_interrupt_vect;
-            _hwserial_dre_interrupt_elevated = 0;
-        }
+// Take the DRE interrupt back to normal priority level if it has been elevated
+void UartClass::_restore_dre_interrupt(void)
+{
+    if(_hwserial_dre_interrupt_elevated) {
+        interrupts_priority_swap(_prev_lvl1_interrupt_vect);
+        _hwserial_dre_interrupt_elevated = 0;
     }
 }
 
-// To invoke data empty "interrupt" via a call, use this method
-void UartClass::_poll_tx_data_empty(void)
+// Disable receiver and transmitter as well as the RX complete and
+// data register empty interrupts.
+void UartClass::_disable(void)
 {
-    if ( (!(SREG & CPU_I_bm)) || (!((*_hwserial_module).CTRLA & USART_DREIE_bm)) ) {
-        // Interrupts are disabled either globally or for data register empty,
-        // so we'll have to poll the "data register empty" flag ourselves.
-        // If it is set, pretend an interrupt has happened and call the handler
-        //to free up space for us.
-
-        // Invoke interrupt handler only if conditions data register is empty
-        if ((*_hwserial_module).STATUS & USART_DREIF_bm) {
-            _tx_data_empty_irq();
-        }
+    (*_hwserial_module).CTRLB &= ~(USART_RXEN_bm | USART_TXEN_bm);
+    (*_hwserial_module).CTRLA &= ~(USART_RXCIE_bm | USART_DREIE_bm);
+
+    _written = false;
+
+    if (_sleep_constraint) {
+        _sleep_constraint = false;
+        sleep_constraint_release(sleep_mode_idle);
     }
-    // In case interrupts are enabled, the interrupt routine will be invoked by itself
 }
 
 // Public Methods //////////////////////////////////////////////////////////////
@@ -148,24 +182,25 @@ void UartClass::begin(unsigned long baud, uint16_t config)
     // Setup port mux
     PORTMUX.USARTROUTEA |= _uart_mux;
 
-    int32_t baud_setting = 0;
+    // Lowest error setting of normal and double speed (CLK2X) modes for
+    // the actual clock: F_CPU corrected by the factory calibration.
+    struct uart_baud_plan plan;
+
+    uart_baud_plan(uart_baud_clock(F_CPU, SIGROW.OSC16ERR5V), baud, &plan);
+    _baud_actual = plan.actual;
+    _baud_error = plan.error_bp;
 
     //Make sure global interrupts are disabled during initialization
     uint8_t oldSREG = SREG;
     cli();
 
-    baud_setting = (((8 * F_CPU) / baud) + 1) / 2;
-    // Disable CLK2X
-    (*_hwserial_module).CTRLB &= (~USART_RXMODE_CLK2X_gc);
-    (*_hwserial_module).CTRLB |= USART_RXMODE_NORMAL_gc;
+    (*_hwserial_module).CTRLB = ((*_hwserial_module).CTRLB & ~USART_RXMODE_gm) |
+                                (plan.clk2x ? USART_RXMODE_CLK2X_gc : USART_RXMODE_NORMAL_gc);
 
     _written = false;
 
-    int8_t sigrow_val = SIGROW.OSC16ERR5V;
-    baud_setting += (baud_setting * sigrow_val) / 1024;
-
-    // assign the baud_setting, a.k.a. BAUD (USART Baud Rate Register)
-    (*_hwserial_module).BAUD = (int16_t) baud_setting;
+    // assign the baud setting, a.k.a. BAUD (USART Baud Rate Register)
+    (*_hwserial_module).BAUD = plan.reg;
 
     // Set USART mode of operation
     (*_hwserial_module).CTRLC = config;
@@ -175,6 +210,14 @@ void UartClass::begin(unsigned long baud, uint16_t config)
 
     (*_hwserial_module).CTRLA |= USART_RXCIE_bm;
 
+    // The USART is clocked from CLK_PER, which stops in standby: while
+    // enabled (receiving or with bytes pending), don't sleep deeper than
+    // idle. end() flushes before releasing the constraint.
+    if (!_sleep_constraint && sleep_constraint_set) {
+        sleep_constraint_set(sleep_mode_idle);
+        _sleep_constraint = true;
+    }
+
     //Set up the rx pin
     pinMode(_hwserial_rx_pin, INPUT_PULLUP);
 
@@ -186,137 +229,59 @@ void UartClass::begin(unsigned long baud, uint16_t config)
     SREG = oldSREG;
 }
 
-void UartClass::end()
+void UartClass::writeChain(UartTxDescriptor *chain)
 {
-    // wait for transmission of outgoing data
-    flush();
-
-    // Disable receiver and transmitter as well as the RX complete and
-    // data register empty interrupts.
-    (*_hwserial_module).CTRLB &= ~(USART_RXEN_bm | USART_TXEN_bm);
-    (*_hwserial_module).CTRLA &= ~(USART_RXCIE_bm | USART_DREIE_bm);
-
-    // clear any received data
-    _rx_buffer_head = _rx_buffer_tail;
+    UartTxDescriptor *last = chain;
+    size_t bytes;
 
-    _written = false;
-}
+    if (chain == NULL) {
+        return;
+    }
+    bytes = chain->length;
+    while (last->next != NULL) {
+        last = last->next;
+        bytes += last->length;
+    }
+    _written = true;
+    // Descriptors don't use the ring buffer: no high-water mark.
+    _tx_stats(bytes, 0);
 
-int UartClass::available(void)
-{
-    return ((unsigned int)(SERIAL_RX_BUFFER_SIZE + _rx_buffer_head - _rx_buffer_tail)) % SERIAL_RX_BUFFER_SIZE;
-}
+    _elevate_dre_interrupt();
 
-int UartClass::peek(void)
-{
-    if (_rx_buffer_head == _rx_buffer_tail) {
-        return -1;
-    } else {
-        return _rx_buffer[_rx_buffer_tail];
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (_tx_chain_tail != NULL) {
+            _tx_chain_tail->next = chain;
+        } else {
+            _tx_chain_head = chain;
+            _tx_chain_offset = 0;
+        }
+        _tx_chain_tail = last;
     }
-}
 
-int UartClass::read(void)
-{
-    // if the head isn't ahead of the tail, we don't have any characters
-    if (_rx_buffer_head == _rx_buffer_tail) {
-        return -1;
-    } else {
-        unsigned char c = _rx_buffer[_rx_buffer_tail];
-        _rx_buffer_tail = (rx_buffer_index_t)(_rx_buffer_tail + 1) % SERIAL_RX_BUFFER_SIZE;
-        return c;
-    }
+    // Enable data "register empty interrupt": the ISR walks the chain
+    (*_hwserial_module).CTRLA |= USART_DREIE_bm;
 }
 
-int UartClass::availableForWrite(void)
+void UartClass::onReceive(UartRxNotify notify, void *context)
 {
-    tx_buffer_index_t head;
-    tx_buffer_index_t tail;
-
-    TX_BUFFER_ATOMIC {
-        head = _tx_buffer_head;
-        tail = _tx_buffer_tail;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        _rx_notify = notify;
+        _rx_notify_context = context;
     }
-    if (head >= tail) return SERIAL_TX_BUFFER_SIZE - 1 - head + tail;
-    return tail - head - 1;
 }
 
-void UartClass::flush()
+void UartClass::readStats(UartStats &stats)
 {
-    // If we have never written a byte, no need to flush. This special
-    // case is needed since there is no way to force the TXCIF (transmit
-    // complete) bit to 1 during initialization
-    if (!_written) {
-        return;
-    }
-
-    //Check if we are inside an ISR already (e.g. connected to a different peripheral then UART), in which case the UART ISRs will not be called.
-    //Temporarily elevate the DRE interrupt to allow it to run.
-    if(CPUINT.STATUS & CPUINT_LVL0EX_bm) {
-        //Elevate the priority level of the Data Register Empty Interrupt vector
-        //and copy whatever vector number that might be in the register already.
-        _prev_lvl1_interrupt_vect = CPUINT.LVL1VEC;
-        CPUINT.LVL1VEC = _hwserial_dre_interrupt_vect_num;
-
-        _hwserial_dre_interrupt_elevated = 1;
-    }
-
-    // Spin until the data-register-empty-interrupt is disabled and TX complete interrupt flag is raised
-    while ( ((*_hwserial_module).CTRLA & USART_DREIE_bm) || (!((*_hwserial_module).STATUS & USART_TXCIF_bm)) ) {
-
-        // If interrupts are globally disabled or the and DR empty interrupt is disabled,
-        // poll the "data register empty" interrupt flag to prevent deadlock
-        _poll_tx_data_empty();
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        stats = _stats;
     }
-    // If we get here, nothing is queued anymore (DREIE is disabled) and
-    // the hardware finished transmission (TXCIF is set).
 }
 
-size_t UartClass::write(uint8_t c)
+void UartClass::resetStats(void)
 {
-    _written = true;
-
-    // If the buffer and the data register is empty, just write the byte
-    // to the data register and be done. This shortcut helps
-    // significantly improve the effective data rate at high (>
-    // 500kbit/s) bit rates, where interrupt overhead becomes a slowdown.
-    if ( (_tx_buffer_head == _tx_buffer_tail) && ((*_hwserial_module).STATUS & USART_DREIF_bm) ) {
-        (*_hwserial_module).TXDATAL = c;
-        (*_hwserial_module).STATUS = USART_TXCIF_bm;
-
-        // Make sure data register empty interrupt is disabled to avoid
-        // that the interrupt handler is called in this situation
-        (*_hwserial_module).CTRLA &= (~USART_DREIE_bm);
-
-        return 1;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memset(&_stats, 0, sizeof(_stats));
     }
-
-    //Check if we are inside an ISR already (could be from by a source other than UART),
-    // in which case the UART ISRs will be blocked.
-    if(CPUINT.STATUS & CPUINT_LVL0EX_bm) {
-        //Elevate the priority level of the Data Register Empty Interrupt vector
-        //and copy whatever vector number that might be in the register already.
-        _prev_lvl1_interrupt_vect = CPUINT.LVL1VEC;
-        CPUINT.LVL1VEC = _hwserial_dre_interrupt_vect_num;
-
-        _hwserial_dre_interrupt_elevated = 1;
-    }
-
-    tx_buffer_index_t i = (_tx_buffer_head + 1) % SERIAL_TX_BUFFER_SIZE;
-
-    //If the output buffer is full, there's nothing for it other than to
-    //wait for the interrupt handler to empty it a bit (or emulate interrupts)
-    while (i == _tx_buffer_tail) {
-        _poll_tx_data_empty();
-    }
-
-    _tx_buffer[_tx_buffer_head] = c;
-    _tx_buffer_head = i;
-
-    // Enable data "register empty interrupt"
-    (*_hwserial_module).CTRLA |= USART_DREIE_bm;
-
-    return 1;
 }
 
 #endif // whole file
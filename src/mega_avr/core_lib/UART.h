@@ -26,20 +26,18 @@
 #include <inttypes.h>
 #include "api/HardwareSerial.h"
 #include "pins_arduino.h"
+#include "SpscRing.h"
 
 using namespace arduino;
 
-// Define constants and variables for buffering incoming serial data.  We're
-// using a ring buffer (I think), in which head is the index of the location
-// to which to write the next incoming character and tail is the index of the
-// location from which to read.
-// NOTE: a "power of 2" buffer size is reccomended to dramatically
-//       optimize all the modulo operations for ring buffers.
-// WARNING: When buffer sizes are increased to > 256, the buffer index
-// variables are automatically increased in size, but the extra
-// atomicity guards needed for that are not implemented. This will
-// often work, but occasionally a race condition can occur that makes
-// Serial behave erratically. See https://github.com/arduino/Arduino/issues/2405
+// Define constants and variables for buffering incoming serial data. The
+// ISRs and the main code share a SpscRing per direction (see SpscRing.h):
+// sizes must be a power of 2 and a buffer holds size - 1 bytes.
+// Sizes are set per instance (i.e. SERIAL1_RX_BUFFER_SIZE=512 as a build
+// define, see TARGET_DEFINES) and default to SERIAL_RX_BUFFER_SIZE and
+// SERIAL_TX_BUFFER_SIZE. Buffers larger than 256 bytes get a 16 bit index,
+// read and written atomically: the other instances keep the 8 bit index
+// and pay nothing for it.
 #if !defined(SERIAL_TX_BUFFER_SIZE)
 #if ((RAMEND - RAMSTART) < 1023)
 #define SERIAL_TX_BUFFER_SIZE 16
@@ -54,15 +52,35 @@ using namespace arduino;
 #define SERIAL_RX_BUFFER_SIZE 64
 #endif
 #endif
-#if (SERIAL_TX_BUFFER_SIZE>256)
-typedef uint16_t tx_buffer_index_t;
-#else
-typedef uint8_t tx_buffer_index_t;
+#if !defined(SERIAL0_TX_BUFFER_SIZE)
+#define SERIAL0_TX_BUFFER_SIZE SERIAL_TX_BUFFER_SIZE
 #endif
-#if  (SERIAL_RX_BUFFER_SIZE>256)
-typedef uint16_t rx_buffer_index_t;
-#else
-typedef uint8_t rx_buffer_index_t;
+#if !defined(SERIAL0_RX_BUFFER_SIZE)
+#define SERIAL0_RX_BUFFER_SIZE SERIAL_RX_BUFFER_SIZE
+#endif
+#if !defined(SERIAL1_TX_BUFFER_SIZE)
+#define SERIAL1_TX_BUFFER_SIZE SERIAL_TX_BUFFER_SIZE
+#endif
+#if !defined(SERIAL1_RX_BUFFER_SIZE)
+#define SERIAL1_RX_BUFFER_SIZE SERIAL_RX_BUFFER_SIZE
+#endif
+#if !defined(SERIAL2_TX_BUFFER_SIZE)
+#define SERIAL2_TX_BUFFER_SIZE SERIAL_TX_BUFFER_SIZE
+#endif
+#if !defined(SERIAL2_RX_BUFFER_SIZE)
+#define SERIAL2_RX_BUFFER_SIZE SERIAL_RX_BUFFER_SIZE
+#endif
+#if !defined(SERIAL3_TX_BUFFER_SIZE)
+#define SERIAL3_TX_BUFFER_SIZE SERIAL_TX_BUFFER_SIZE
+#endif
+#if !defined(SERIAL3_RX_BUFFER_SIZE)
+#define SERIAL3_RX_BUFFER_SIZE SERIAL_RX_BUFFER_SIZE
+#endif
+
+// Number of received frames that can wait for the consumer in frame mode
+// (see UartBuffered::setFrameMode). Must be a power of 2.
+#if !defined(SERIAL_RX_FRAMES)
+#define SERIAL_RX_FRAMES 4
 #endif
 
 // Define config for Serial.begin(baud, config);
@@ -122,6 +140,54 @@ typedef uint8_t rx_buffer_index_t;
 #define SERIAL_7O2 (USART_CMODE_ASYNCHRONOUS_gc | USART_CHSIZE_7BIT_gc | USART_PMODE_ODD_gc | USART_SBMODE_2BIT_gc)
 #define SERIAL_8O2 (USART_CMODE_ASYNCHRONOUS_gc | USART_CHSIZE_8BIT_gc | USART_PMODE_ODD_gc | USART_SBMODE_2BIT_gc)
 
+// Descriptor of a buffer sent without copying it (see UartClass::writeChain).
+// Buffers and descriptors are owned by the caller and must stay untouched
+// until the descriptor completes. Queuing a chain links it after the last
+// pending descriptor; completing a descriptor resets its next to NULL.
+struct UartTxDescriptor
+{
+  const uint8_t *data;     // Bytes to send, in RAM (or mapped flash) or in PROGMEM.
+  uint16_t length;
+  bool progmem;            // data is a PROGMEM address: read with pgm_read_byte.
+  // Optional. Called from the DRE ISR once the last byte of the descriptor
+  // is handed to the hardware: the descriptor can then be reused.
+  void (*complete)(UartTxDescriptor *desc);
+  UartTxDescriptor *next;  // Next descriptor of the chain, NULL at the end.
+                           // Reset to NULL on completion.
+};
+
+// Frame received in frame mode (see UartBuffered::readFrame). The bytes stay
+// in the receive buffer: a frame wrapping around the end of the buffer is
+// made of two spans.
+#define UART_FRAME_IDLE    0x01  // Closed by an idle gap, not by the delimiter.
+#define UART_FRAME_OVERRUN 0x02  // Bytes were lost: the receive buffer was full.
+struct UartRxFrame
+{
+  const uint8_t *data;     // First span.
+  uint16_t length;
+  const uint8_t *wrap;     // Second span, at the start of the buffer.
+  uint16_t wrap_length;    // 0 if the frame is contiguous.
+  uint8_t flags;           // UART_FRAME_* flags.
+};
+
+// Link statistics of an instance (see UartClass::readStats). Counters wrap.
+struct UartStats
+{
+  uint32_t rx_bytes;       // Bytes received, parity errors excluded.
+  uint32_t tx_bytes;       // Bytes queued for transmission.
+  uint16_t rx_dropped;     // Bytes lost because the receive buffer was full (slow consumer).
+  uint16_t hw_overruns;    // Hardware buffer overflows (BUFOVF): the RX ISR was held off too long.
+  uint16_t frame_errors;   // Bytes with a bad stop bit (FERR): baud rate mismatch or noise.
+  uint16_t parity_errors;  // Bytes discarded with a parity error (PERR).
+  uint16_t rx_high_water;  // Most bytes waiting in the receive buffer.
+  uint16_t tx_high_water;  // Most bytes waiting in the transmit buffer.
+};
+
+// Receive notification (see UartClass::onReceive). frame is true when a
+// frame was closed in frame mode, false when bytes arrived.
+typedef void (*UartRxNotify)(void *context, bool frame);
+
+// Hardware handling shared by all the instances, whatever their buffer sizes.
 class UartClass : public HardwareSerial
 {
   protected:
@@ -135,25 +201,120 @@ class UartClass : public HardwareSerial
     // Has any byte been written to the UART since begin()
     bool _written;
 
-    volatile rx_buffer_index_t _rx_buffer_head;
-    volatile rx_buffer_index_t _rx_buffer_tail;
-    volatile tx_buffer_index_t _tx_buffer_head;
-    volatile tx_buffer_index_t _tx_buffer_tail;
-
     volatile uint8_t _hwserial_dre_interrupt_vect_num;
     volatile uint8_t _hwserial_dre_interrupt_elevated;
     volatile uint8_t _prev_lvl1_interrupt_vect;
 
-    // Don't put any members after these buffers, since only the first
-    // 32 bytes of this struct can be accessed quickly using the ldd
-    // instruction.
-    unsigned char _rx_buffer[SERIAL_RX_BUFFER_SIZE];
-    unsigned char _tx_buffer[SERIAL_TX_BUFFER_SIZE];
+    UartClass* bound = NULL;
+
+    // Descriptors queued by writeChain, sent by the DRE ISR once the
+    // ring buffer is empty.
+    UartTxDescriptor * volatile _tx_chain_head = NULL;
+    UartTxDescriptor * volatile _tx_chain_tail = NULL;
+    uint16_t _tx_chain_offset = 0;
+
+    UartRxNotify _rx_notify = NULL;
+    void *_rx_notify_context = NULL;
+
+    // Updated by the RX ISR and the write paths, read with interrupts off.
+    UartStats _stats = {};
+
+    // Rate set by begin() (see hal/uart/uart_baud.h).
+    uint32_t _baud_actual = 0;
+    int16_t _baud_error = 0;
+
+    // Sleep constraint held from begin() to end() (see hal/sleep/sleep.h).
+    bool _sleep_constraint = false;
+
+    inline void _rx_notify_irq(bool frame) {
+      if (_rx_notify != NULL) {
+        _rx_notify(_rx_notify_context, frame);
+      }
+    }
+    // Account for queued bytes, fill is the transmit buffer level after.
+    inline void _tx_stats(size_t bytes, uint16_t fill);
+    bool _tx_chain_irq(void);
+    void _tx_chain_pop(UartTxDescriptor *desc);
+    void _elevate_dre_interrupt(void);
+    void _restore_dre_interrupt(void);
+    void _disable(void);
 
   public:
     inline UartClass(volatile USART_t *hwserial_module, uint8_t hwserial_rx_pin, uint8_t hwserial_tx_pin, uint8_t dre_vect_num, uint8_t uart_mux);
     void begin(unsigned long baud) { begin(baud, SERIAL_8N1); }
     void begin(unsigned long, uint16_t);
+    using Print::write; // pull in write(str) and write(const char *, size) from Print
+    explicit operator bool() { return true; }
+
+    void bind(UartClass& ser) {bound = &ser; }
+
+    // Baud rate achieved by begin() and its error against the requested
+    // one, in 0.01 % units. Rates out of reach (above F_CPU / 8 at 2
+    // Mbaud with a 16 MHz clock, or too slow) get the closest setting.
+    uint32_t baudActual(void) { return _baud_actual; }
+    int16_t baudError(void) { return _baud_error; }
+
+    // Queue a chain of descriptors (i.e. header, payload, CRC) for
+    // transmission straight from the caller's buffers. Doesn't block.
+    // Bytes written before are sent first, bytes written after wait for
+    // the chain to be sent.
+    void writeChain(UartTxDescriptor *chain);
+    // True until every queued descriptor has been handed to the hardware.
+    bool chainPending(void) { return _tx_chain_head != NULL; }
+
+    // Call notify(context, frame) from the RX complete ISR when there's
+    // something to read, so the main loop can sleep instead of polling
+    // (i.e. post an event, see framework/serial/serial_events.h). It is
+    // edge triggered: in stream mode once when a byte lands in an empty
+    // buffer (read until available() is 0 before waiting again), in frame
+    // mode once per frame closed by the delimiter or by the idle gap (on
+    // the first byte of a frame instead, if readFrame() has to check the
+    // gap, see setFrameMode).
+    // Keep it short. NULL stops the notifications.
+    void onReceive(UartRxNotify notify, void *context);
+
+    // Copy the link statistics, all the counters at the same time.
+    void readStats(UartStats &stats);
+    // Clear the counters and the high-water marks.
+    void resetStats(void);
+};
+
+// Ring buffers and interrupt handlers of an instance. Implementation is in
+// UART_private.h: each UARTn.cpp instantiates its own sizes.
+template <size_t RX_SIZE, size_t TX_SIZE>
+class UartBuffered : public UartClass
+{
+  protected:
+    typedef typename SpscRing<RX_SIZE>::index_t rx_buffer_index_t;
+
+    // Frame mode: _rx holds whole frames, from its tail (start of the
+    // oldest frame not released) to _rx_frame_start (start of the frame
+    // being received). Completed frames are listed in _rx_frames.
+    struct RxFrameEntry
+    {
+      rx_buffer_index_t end;
+      uint8_t flags;
+    };
+    static_assert((SERIAL_RX_FRAMES & (SERIAL_RX_FRAMES - 1)) == 0, "SERIAL_RX_FRAMES must be a power of 2");
+    bool _rx_frame_mode;
+    int16_t _rx_delimiter;
+    uint16_t _rx_idle_us;
+    // Virtual timer channel closing idle gap frames (timer_channel_t, see
+    // hal/timers/timer.h) and its callback, calling _rx_idle_irq().
+    uint8_t _rx_idle_ch;
+    void (*_rx_idle_clbk)(void);
+    volatile rx_buffer_index_t _rx_frame_start;
+    volatile uint8_t _rx_frame_flags;
+    volatile uint8_t _rx_frames_head;
+    volatile uint8_t _rx_frames_tail;
+    volatile unsigned long _rx_last_us;
+    volatile RxFrameEntry _rx_frames[SERIAL_RX_FRAMES];
+
+    SpscRing<RX_SIZE> _rx;
+    SpscRing<TX_SIZE> _tx;
+
+  public:
+    inline UartBuffered(volatile USART_t *hwserial_module, uint8_t hwserial_rx_pin, uint8_t hwserial_tx_pin, uint8_t dre_vect_num, uint8_t uart_mux, void (*rx_idle_clbk)(void));
     void end();
     virtual int available(void);
     virtual int peek(void);
@@ -161,37 +322,62 @@ class UartClass : public HardwareSerial
     virtual int availableForWrite(void);
     virtual void flush(void);
     virtual size_t write(uint8_t);
+    virtual size_t write(const uint8_t *buffer, size_t size);
     inline size_t write(unsigned long n) { return write((uint8_t)n); }
     inline size_t write(long n) { return write((uint8_t)n); }
     inline size_t write(unsigned int n) { return write((uint8_t)n); }
     inline size_t write(int n) { return write((uint8_t)n); }
-    using Print::write; // pull in write(str) and write(buf, size) from Print
-    explicit operator bool() { return true; }
+    using UartClass::write;
 
-    void bind(UartClass& ser) {bound = &ser; }
+    // Frame receive mode. The ISR closes a frame on the delimiter byte
+    // (i.e. 0x00 for COBS, '\n'; -1 for none, the delimiter is not stored)
+    // or when no byte arrived for idle_us microseconds (0 for none). The
+    // gap is timed with a virtual timer channel of the HAL timer, opened
+    // on the first call with idle_us (call it after timer_init), up to one
+    // tick late. Without the HAL timer or a free channel, readFrame checks
+    // it against micros(). Bytes received so far are dropped.
+    // setFrameMode(-1, 0) goes back to the byte stream mode. Don't mix
+    // available()/read() and readFrame() in frame mode.
+    void setFrameMode(int delimiter, uint16_t idle_us);
+    // Get the oldest received frame without copying it. Returns false if
+    // there's none. The frame stays valid until releaseFrame().
+    bool readFrame(UartRxFrame &frame);
+    // Give the oldest frame back to the receiver.
+    void releaseFrame(void);
 
     // Interrupt handlers - Not intended to be called externally
     inline void _rx_complete_irq(void);
     void _tx_data_empty_irq(void);
+    void _rx_idle_irq(void);
   private:
     void _poll_tx_data_empty(void);
-    UartClass* bound = NULL;
+    void _wait_tx_chain(void);
+    void _rx_clear(void);
+    inline void _rx_stats(void);
+    inline void _rx_frame_byte(unsigned char c);
+    inline void _rx_idle_arm(uint16_t us);
+    bool _rx_close_frame(uint8_t flags);
 };
 
+typedef UartBuffered<SERIAL0_RX_BUFFER_SIZE, SERIAL0_TX_BUFFER_SIZE> Uart0Class;
+typedef UartBuffered<SERIAL1_RX_BUFFER_SIZE, SERIAL1_TX_BUFFER_SIZE> Uart1Class;
+typedef UartBuffered<SERIAL2_RX_BUFFER_SIZE, SERIAL2_TX_BUFFER_SIZE> Uart2Class;
+typedef UartBuffered<SERIAL3_RX_BUFFER_SIZE, SERIAL3_TX_BUFFER_SIZE> Uart3Class;
+
 #if defined(HWSERIAL0)
-  extern UartClass Serial;
+  extern Uart0Class Serial;
   #define HAVE_HWSERIAL0
 #endif
 #if defined(HWSERIAL1)
-  extern UartClass Serial1;
+  extern Uart1Class Serial1;
   #define HAVE_HWSERIAL1
 #endif
 #if defined(HWSERIAL2)
-  extern UartClass Serial2;
+  extern Uart2Class Serial2;
   #define HAVE_HWSERIAL2
 #endif
 #if defined(HWSERIAL3)
-  extern UartClass Serial3;
+  extern Uart3Class Serial3;
   #define HAVE_HWSERIAL3
 #endif
 
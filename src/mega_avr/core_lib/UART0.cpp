@@ -39,6 +39,7 @@
 #if defined(HWSERIAL0_RXC_VECTOR)
 ISR(HWSERIAL0_RXC_VECTOR)
 {
+  ISR_PROFILE_SCOPE(isr_profile_serial_rxc);
   Serial._rx_complete_irq();
 }
 #else
@@ -48,6 +49,7 @@ ISR(HWSERIAL0_RXC_VECTOR)
 #if defined(HWSERIAL0_DRE_VECTOR)
 ISR(HWSERIAL0_DRE_VECTOR)
 {
+  ISR_PROFILE_SCOPE(isr_profile_serial_dre);
   Serial._tx_data_empty_irq();
 }
 #else
@@ -55,7 +57,14 @@ ISR(HWSERIAL0_DRE_VECTOR)
 #endif
 
 #if defined(HWSERIAL0)
-  UartClass Serial(HWSERIAL0, PIN_WIRE_HWSERIAL0_RX, PIN_WIRE_HWSERIAL0_TX, HWSERIAL0_DRE_VECTOR_NUM, HWSERIAL0_MUX);
+  static void serial0_rx_idle(void);
+  Uart0Class Serial(HWSERIAL0, PIN_WIRE_HWSERIAL0_RX, PIN_WIRE_HWSERIAL0_TX, HWSERIAL0_DRE_VECTOR_NUM, HWSERIAL0_MUX, serial0_rx_idle);
+
+  // Idle gap timer callback (see UartBuffered::setFrameMode).
+  static void serial0_rx_idle(void)
+  {
+    Serial._rx_idle_irq();
+  }
 #endif
 
 // Function that can be weakly referenced by serialEventRun to prevent
@@ -39,6 +39,7 @@
 #if defined(HWSERIAL1_RXC_VECTOR)
 ISR(HWSERIAL1_RXC_VECTOR)
 {
+  ISR_PROFILE_SCOPE(isr_profile_serial1_rxc);
   Serial1._rx_complete_irq();
 }
 #else
@@ -48,6 +49,7 @@ ISR(HWSERIAL1_RXC_VECTOR)
 #if defined(HWSERIAL1_DRE_VECTOR)
 ISR(HWSERIAL1_DRE_VECTOR)
 {
+  ISR_PROFILE_SCOPE(isr_profile_serial1_dre);
   Serial1._tx_data_empty_irq();
 }
 #else
@@ -55,7 +57,14 @@ ISR(HWSERIAL1_DRE_VECTOR)
 #endif
 
 #if defined(HWSERIAL1)
-  UartClass Serial1(HWSERIAL1, PIN_WIRE_HWSERIAL1_RX, PIN_WIRE_HWSERIAL1_TX, HWSERIAL1_DRE_VECTOR_NUM, HWSERIAL1_MUX);
+  static void serial1_rx_idle(void);
+  Uart1Class Serial1(HWSERIAL1, PIN_WIRE_HWSERIAL1_RX, PIN_WIRE_HWSERIAL1_TX, HWSERIAL1_DRE_VECTOR_NUM, HWSERIAL1_MUX, serial1_rx_idle);
+
+  // Idle gap timer callback (see UartBuffered::setFrameMode).
+  static void serial1_rx_idle(void)
+  {
+    Serial1._rx_idle_irq();
+  }
 #endif
 
 // Function that can be weakly referenced by serialEventRun to prevent
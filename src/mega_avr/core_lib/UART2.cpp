@@ -39,6 +39,7 @@
 #if defined(HWSERIAL2_RXC_VECTOR)
 ISR(HWSERIAL2_RXC_VECTOR)
 {
+  ISR_PROFILE_SCOPE(isr_profile_serial2_rxc);
   Serial2._rx_complete_irq();
 }
 #else
@@ -48,6 +49,7 @@ ISR(HWSERIAL2_RXC_VECTOR)
 #if defined(HWSERIAL2_DRE_VECTOR)
 ISR(HWSERIAL2_DRE_VECTOR)
 {
+  ISR_PROFILE_SCOPE(isr_profile_serial2_dre);
   Serial2._tx_data_empty_irq();
 }
 #else
@@ -55,7 +57,14 @@ ISR(HWSERIAL2_DRE_VECTOR)
 #endif
 
 #if defined(HWSERIAL2)
-  UartClass Serial2(HWSERIAL2, PIN_WIRE_HWSERIAL2_RX, PIN_WIRE_HWSERIAL2_TX, HWSERIAL2_DRE_VECTOR_NUM, HWSERIAL2_MUX);
+  static void serial2_rx_idle(void);
+  Uart2Class Serial2(HWSERIAL2, PIN_WIRE_HWSERIAL2_RX, PIN_WIRE_HWSERIAL2_TX, HWSERIAL2_DRE_VECTOR_NUM, HWSERIAL2_MUX, serial2_rx_idle);
+
+  // Idle gap timer callback (see UartBuffered::setFrameMode).
+  static void serial2_rx_idle(void)
+  {
+    Serial2._rx_idle_irq();
+  }
 #endif
 
 // Function that can be weakly referenced by serialEventRun to prevent
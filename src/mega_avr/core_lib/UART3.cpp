@@ -39,6 +39,7 @@
 #if defined(HWSERIAL3_RXC_VECTOR)
 ISR(HWSERIAL3_RXC_VECTOR)
 {
+  ISR_PROFILE_SCOPE(isr_profile_serial3_rxc);
   Serial3._rx_complete_irq();
 }
 #else
@@ -48,6 +49,7 @@ ISR(HWSERIAL3_RXC_VECTOR)
 #if defined(HWSERIAL3_DRE_VECTOR)
 ISR(HWSERIAL3_DRE_VECTOR)
 {
+  ISR_PROFILE_SCOPE(isr_profile_serial3_dre);
   Serial3._tx_data_empty_irq();
 }
 #else
@@ -55,7 +57,14 @@ ISR(HWSERIAL3_DRE_VECTOR)
 #endif
 
 #if defined(HWSERIAL3)
-  UartClass Serial3(HWSERIAL3, PIN_WIRE_HWSERIAL3_RX, PIN_WIRE_HWSERIAL3_TX, HWSERIAL3_DRE_VECTOR_NUM, HWSERIAL3_MUX);
+  static void serial3_rx_idle(void);
+  Uart3Class Serial3(HWSERIAL3, PIN_WIRE_HWSERIAL3_RX, PIN_WIRE_HWSERIAL3_TX, HWSERIAL3_DRE_VECTOR_NUM, HWSERIAL3_MUX, serial3_rx_idle);
+
+  // Idle gap timer callback (see UartBuffered::setFrameMode).
+  static void serial3_rx_idle(void)
+  {
+    Serial3._rx_idle_irq();
+  }
 #endif
 
 // Function that can be weakly referenced by serialEventRun to prevent
@@ -21,7 +21,23 @@
   Modified 14 August 2012 by Alarus
 */
 
+#include <util/atomic.h>
 #include "wiring_private.h"
+#include "timer.h"
+
+// ISR profiling (see hal/interrupts/isr_profile.h) is opt-in: targets that
+// don't enable it need not export the header.
+#ifdef ISR_PROFILE
+#include "isr_profile.h"
+#else
+#define ISR_PROFILE_SCOPE(id)
+#endif
+
+// Idle gap timeouts use a virtual timer channel of the HAL timer (see
+// hal/timers/timer.h), only linked in by the targets using it: without it
+// readFrame() checks the gap.
+extern "C" timer_channel_t timer_channel_open(timer_callback_t clbk) __attribute__((weak));
+extern "C" void timer_channel_start_ticks(timer_channel_t ch, uint32_t ticks, bool continuous) __attribute__((weak));
 
 // this next line disables the entire UART.cpp, 
 // this is so I can support Attiny series and any other chip without a uart
@@ -39,32 +55,85 @@ UartClass::UartClass(
     _hwserial_rx_pin(hwserial_rx_pin),
     _hwserial_tx_pin(hwserial_tx_pin),
     _uart_mux(uart_mux),
-    _rx_buffer_head(0), _rx_buffer_tail(0),
-    _tx_buffer_head(0), _tx_buffer_tail(0),
     _hwserial_dre_interrupt_vect_num(hwserial_dre_interrupt_vect_num),
     _hwserial_dre_interrupt_elevated(0),
     _prev_lvl1_interrupt_vect(0)
 {
 }
 
+template <size_t RX_SIZE, size_t TX_SIZE>
+UartBuffered<RX_SIZE, TX_SIZE>::UartBuffered(
+  volatile USART_t *hwserial_module,
+  uint8_t hwserial_rx_pin,
+  uint8_t hwserial_tx_pin,
+  uint8_t hwserial_dre_interrupt_vect_num,
+  uint8_t uart_mux,
+  void (*rx_idle_clbk)(void)) :
+    UartClass(hwserial_module, hwserial_rx_pin, hwserial_tx_pin, hwserial_dre_interrupt_vect_num, uart_mux),
+    _rx_frame_mode(false), _rx_delimiter(-1), _rx_idle_us(0),
+    _rx_idle_ch(TIMER_CHANNEL_NONE), _rx_idle_clbk(rx_idle_clbk),
+    _rx_frame_start(0), _rx_frame_flags(0),
+    _rx_frames_head(0), _rx_frames_tail(0)
+{
+}
+
+void UartClass::_tx_stats(size_t bytes, uint16_t fill)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    _stats.tx_bytes += bytes;
+    if (fill > _stats.tx_high_water) {
+      _stats.tx_high_water = fill;
+    }
+  }
+}
+
 // Actual interrupt handlers //////////////////////////////////////////////////////////////
 
-void UartClass::_rx_complete_irq(void)
+// Count a byte stored in the receive buffer, from the RX complete ISR.
+template <size_t RX_SIZE, size_t TX_SIZE>
+void UartBuffered<RX_SIZE, TX_SIZE>::_rx_stats(void)
 {
+  uint16_t fill = _rx.available();
+
+  if (fill > _stats.rx_high_water) {
+    _stats.rx_high_water = fill;
+  }
+}
+
+template <size_t RX_SIZE, size_t TX_SIZE>
+void UartBuffered<RX_SIZE, TX_SIZE>::_rx_complete_irq(void)
+{
+  // Error flags belong to the byte in RXDATAL: read them first.
+  uint8_t status = (*_hwserial_module).RXDATAH;
+
+  if (status & USART_BUFOVF_bm) {
+    _stats.hw_overruns++;
+  }
+  if (status & USART_FERR_bm) {
+    _stats.frame_errors++;
+  }
   //if (bit_is_clear(*_rxdatah, USART_PERR_bp)) {
-  if (!(((*_hwserial_module).RXDATAH) & USART_PERR_bm)) {
+  if (!(status & USART_PERR_bm)) {
     // No Parity error, read byte and store it in the buffer if there is
     // room
     unsigned char c = (*_hwserial_module).RXDATAL;
-    rx_buffer_index_t i = (unsigned int)(_rx_buffer_head + 1) % SERIAL_RX_BUFFER_SIZE;
 
-    // if we should be storing the received character into the location
-    // just before the tail (meaning that the head would advance to the
-    // current location of the tail), we're about to overflow the buffer
-    // and so we don't write the character or advance the head.
-    if (i != _rx_buffer_tail) {
-      _rx_buffer[_rx_buffer_head] = c;
-      _rx_buffer_head = i;
+    _stats.rx_bytes++;
+    if (_rx_frame_mode) {
+      _rx_frame_byte(c);
+    } else {
+      bool empty = _rx.empty();
+
+      // if the buffer is full, we're about to overflow it and so we
+      // drop the character.
+      if (_rx.push(c)) {
+        _rx_stats();
+        if (empty) {
+          _rx_notify_irq(false);
+        }
+      } else {
+        _stats.rx_dropped++;
+      }
     }
     if (bound != NULL) {
       bound->write(c);
@@ -72,7 +141,382 @@ void UartClass::_rx_complete_irq(void)
   } else {
     // Parity error, read byte but discard it
     (*_hwserial_module).RXDATAL;
+    _stats.parity_errors++;
+  }
+}
+
+// Frame mode receive, from the RX complete ISR.
+template <size_t RX_SIZE, size_t TX_SIZE>
+void UartBuffered<RX_SIZE, TX_SIZE>::_rx_frame_byte(unsigned char c)
+{
+  if (c == _rx_delimiter) {
+    if (_rx_close_frame(0)) {
+      _rx_notify_irq(true);
+    }
+    return;
+  }
+
+  bool first = (_rx.head() == _rx_frame_start) && (_rx_frame_flags == 0);
+
+  if (_rx.push(c)) {
+    _rx_stats();
+  } else {
+    _rx_frame_flags |= UART_FRAME_OVERRUN;
+    _stats.rx_dropped++;
+  }
+  if (_rx_idle_us != 0) {
+    _rx_last_us = micros();
+    if (first) {
+      if (_rx_idle_ch != TIMER_CHANNEL_NONE) {
+        // The timer closes the frame once the line is idle.
+        _rx_idle_arm(_rx_idle_us);
+      } else {
+        // Only readFrame() sees the gap: wake the consumer up to poll it.
+        _rx_notify_irq(false);
+      }
+    }
+  }
+}
+
+// Idle gap timer expired, from the timer interrupt. Bytes received since it
+// was armed push the gap further: check and arm again for what is left.
+template <size_t RX_SIZE, size_t TX_SIZE>
+void UartBuffered<RX_SIZE, TX_SIZE>::_rx_idle_irq(void)
+{
+  // Closed meanwhile (delimiter, setFrameMode).
+  if ((_rx_idle_us == 0) || ((_rx.head() == _rx_frame_start) && (_rx_frame_flags == 0))) {
+    return;
+  }
+
+  unsigned long idle = micros() - _rx_last_us;
+
+  if (idle >= _rx_idle_us) {
+    if (_rx_close_frame(UART_FRAME_IDLE)) {
+      _rx_notify_irq(true);
+    }
+  } else {
+    _rx_idle_arm(_rx_idle_us - idle);
+  }
+}
+
+// Arm the idle gap timer "us" microseconds from now, rounded up to whole
+// ticks plus one for the phase of the current tick.
+template <size_t RX_SIZE, size_t TX_SIZE>
+void UartBuffered<RX_SIZE, TX_SIZE>::_rx_idle_arm(uint16_t us)
+{
+  uint32_t ticks = ((uint32_t)us * TIMER_TICKS_PER_SEC + 999999UL) / 1000000UL + 1;
+
+  timer_channel_start_ticks(_rx_idle_ch, ticks, false);
+}
+
+// Append the frame being received to the frame ring. Called from the ISR or
+// with interrupts disabled. Returns true if a frame was queued.
+template <size_t RX_SIZE, size_t TX_SIZE>
+bool UartBuffered<RX_SIZE, TX_SIZE>::_rx_close_frame(uint8_t flags)
+{
+  // Back to back delimiters: nothing to report.
+  rx_buffer_index_t head = _rx.head();
+
+  if ((head == _rx_frame_start) && (_rx_frame_flags == 0)) {
+    return false;
   }
+
+  uint8_t next = (_rx_frames_head + 1) & (SERIAL_RX_FRAMES - 1);
+  bool queued = (next != _rx_frames_tail);
+
+  if (!queued) {
+    // No room for one more frame: drop it.
+    head = _rx_frame_start;
+    _rx.rewind(head);
+  } else {
+    _rx_frames[_rx_frames_head].end = head;
+    _rx_frames[_rx_frames_head].flags = _rx_frame_flags | flags;
+    _rx_frames_head = next;
+  }
+  _rx_frame_start = head;
+  _rx_frame_flags = 0;
+  return queued;
+}
+
+template <size_t RX_SIZE, size_t TX_SIZE>
+void UartBuffered<RX_SIZE, TX_SIZE>::_tx_data_empty_irq(void)
+{
+    unsigned char c;
+
+    // Check if tx buffer already empty, else take the next byte.
+    if (!_tx.pop(c)) {
+        // Ring is drained: continue with the descriptor chain, if any
+        if (_tx_chain_irq()) {
+            return;
+        }
+        // Buffer empty, so disable "data register empty" interrupt
+        (*_hwserial_module).CTRLA &= (~USART_DREIE_bm);
+
+        _restore_dre_interrupt();
+        return;
+    }
+
+    // clear the TXCIF flag -- "can be cleared by writing a one to its bit
+    // location". This makes sure flush() won't return until the bytes
+    // actually got written
+    (*_hwserial_module).STATUS = USART_TXCIF_bm;
+
+    (*_hwserial_module).TXDATAL = c;
+
+    if (_tx.empty() && (_tx_chain_head == NULL)) {
+        // Buffer empty, so disable "data register empty" interrupt
+        (*_hwserial_module).CTRLA &= (~USART_DREIE_bm);
+
+        _restore_dre_interrupt();
+    }
+}
+
+// Stream data must not overtake queued descriptors: wait for the chain
+template <size_t RX_SIZE, size_t TX_SIZE>
+void UartBuffered<RX_SIZE, TX_SIZE>::_wait_tx_chain(void)
+{
+    if (_tx_chain_head != NULL) {
+        _elevate_dre_interrupt();
+        while (_tx_chain_head != NULL) {
+            _poll_tx_data_empty();
+        }
+    }
+}
+
+// To invoke data empty "interrupt" via a call, use this method
+template <size_t RX_SIZE, size_t TX_SIZE>
+void UartBuffered<RX_SIZE, TX_SIZE>::_poll_tx_data_empty(void)
+{
+    if ( (!(SREG & CPU_I_bm)) || (!((*_hwserial_module).CTRLA & USART_DREIE_bm)) ) {
+        // Interrupts are disabled either globally or for data register empty,
+        // so we'll have to poll the "data register empty" flag ourselves.
+        // If it is set, pretend an interrupt has happened and call the handler
+        //to free up space for us.
+
+        // Invoke interrupt handler only if conditions data register is empty
+        if ((*_hwserial_module).STATUS & USART_DREIF_bm) {
+            _tx_data_empty_irq();
+        }
+    }
+    // In case interrupts are enabled, the interrupt routine will be invoked by itself
+}
+
+// Public Methods //////////////////////////////////////////////////////////////
+
+template <size_t RX_SIZE, size_t TX_SIZE>
+void UartBuffered<RX_SIZE, TX_SIZE>::end()
+{
+    // wait for transmission of outgoing data
+    flush();
+
+    _disable();
+
+    // clear any received data
+    _rx_clear();
+}
+
+template <size_t RX_SIZE, size_t TX_SIZE>
+void UartBuffered<RX_SIZE, TX_SIZE>::_rx_clear(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        _rx.clear();
+        _rx_frame_start = _rx.head();
+        _rx_frame_flags = 0;
+        _rx_frames_head = _rx_frames_tail;
+    }
+}
+
+template <size_t RX_SIZE, size_t TX_SIZE>
+void UartBuffered<RX_SIZE, TX_SIZE>::setFrameMode(int delimiter, uint16_t idle_us)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        _rx_delimiter = delimiter;
+        _rx_idle_us = idle_us;
+        _rx_frame_mode = (delimiter >= 0) || (idle_us != 0);
+        _rx_last_us = micros();
+        _rx_clear();
+        if ((idle_us != 0) && (_rx_idle_ch == TIMER_CHANNEL_NONE) &&
+            timer_channel_open && (_rx_idle_clbk != NULL)) {
+            _rx_idle_ch = timer_channel_open(_rx_idle_clbk);
+        }
+    }
+}
+
+template <size_t RX_SIZE, size_t TX_SIZE>
+bool UartBuffered<RX_SIZE, TX_SIZE>::readFrame(UartRxFrame &frame)
+{
+    if (_rx_idle_us != 0) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            if ((_rx.head() != _rx_frame_start) && ((micros() - _rx_last_us) >= _rx_idle_us)) {
+                _rx_close_frame(UART_FRAME_IDLE);
+            }
+        }
+    }
+    if (_rx_frames_tail == _rx_frames_head) {
+        return false;
+    }
+
+    // The ISR doesn't touch a frame entry until it is released.
+    const volatile RxFrameEntry &entry = _rx_frames[_rx_frames_tail];
+    rx_buffer_index_t start = _rx.tail();
+
+    frame.data = _rx.at(start);
+    frame.flags = entry.flags;
+    if (entry.end >= start) {
+        frame.length = entry.end - start;
+        frame.wrap = NULL;
+        frame.wrap_length = 0;
+    } else {
+        frame.length = RX_SIZE - start;
+        frame.wrap = _rx.at(0);
+        frame.wrap_length = entry.end;
+    }
+    return true;
+}
+
+template <size_t RX_SIZE, size_t TX_SIZE>
+void UartBuffered<RX_SIZE, TX_SIZE>::releaseFrame(void)
+{
+    if (_rx_frames_tail == _rx_frames_head) {
+        return;
+    }
+    _rx.release(_rx_frames[_rx_frames_tail].end);
+    _rx_frames_tail = (_rx_frames_tail + 1) & (SERIAL_RX_FRAMES - 1);
+}
+
+template <size_t RX_SIZE, size_t TX_SIZE>
+int UartBuffered<RX_SIZE, TX_SIZE>::available(void)
+{
+    return _rx.available();
+}
+
+template <size_t RX_SIZE, size_t TX_SIZE>
+int UartBuffered<RX_SIZE, TX_SIZE>::peek(void)
+{
+    return _rx.peek();
+}
+
+template <size_t RX_SIZE, size_t TX_SIZE>
+int UartBuffered<RX_SIZE, TX_SIZE>::read(void)
+{
+    return _rx.read();
+}
+
+template <size_t RX_SIZE, size_t TX_SIZE>
+int UartBuffered<RX_SIZE, TX_SIZE>::availableForWrite(void)
+{
+    return _tx.availableForWrite();
+}
+
+template <size_t RX_SIZE, size_t TX_SIZE>
+void UartBuffered<RX_SIZE, TX_SIZE>::flush()
+{
+    // If we have never written a byte, no need to flush. This special
+    // case is needed since there is no way to force the TXCIF (transmit
+    // complete) bit to 1 during initialization
+    if (!_written) {
+        return;
+    }
+
+    _elevate_dre_interrupt();
+
+    // Spin until the data-register-empty-interrupt is disabled and TX complete interrupt flag is raised
+    while ( ((*_hwserial_module).CTRLA & USART_DREIE_bm) || (!((*_hwserial_module).STATUS & USART_TXCIF_bm)) ) {
+
+        // If interrupts are globally disabled or the and DR empty interrupt is disabled,
+        // poll the "data register empty" interrupt flag to prevent deadlock
+        _poll_tx_data_empty();
+    }
+    // If we get here, nothing is queued anymore (DREIE is disabled) and
+    // the hardware finished transmission (TXCIF is set).
+}
+
+template <size_t RX_SIZE, size_t TX_SIZE>
+size_t UartBuffered<RX_SIZE, TX_SIZE>::write(uint8_t c)
+{
+    _written = true;
+    _wait_tx_chain();
+
+    // If the buffer and the data register is empty, just write the byte
+    // to the data register and be done. This shortcut helps
+    // significantly improve the effective data rate at high (>
+    // 500kbit/s) bit rates, where interrupt overhead becomes a slowdown.
+    if ( _tx.empty() && ((*_hwserial_module).STATUS & USART_DREIF_bm) ) {
+        (*_hwserial_module).TXDATAL = c;
+        (*_hwserial_module).STATUS = USART_TXCIF_bm;
+
+        // Make sure data register empty interrupt is disabled to avoid
+        // that the interrupt handler is called in this situation
+        (*_hwserial_module).CTRLA &= (~USART_DREIE_bm);
+
+        _tx_stats(1, 0);
+        return 1;
+    }
+
+    _elevate_dre_interrupt();
+
+    //If the output buffer is full, there's nothing for it other than to
+    //wait for the interrupt handler to empty it a bit (or emulate interrupts)
+    while (!_tx.push(c)) {
+        _poll_tx_data_empty();
+    }
+
+    // Enable data "register empty interrupt"
+    (*_hwserial_module).CTRLA |= USART_DREIE_bm;
+
+    _tx_stats(1, _tx.available());
+    return 1;
+}
+
+template <size_t RX_SIZE, size_t TX_SIZE>
+size_t UartBuffered<RX_SIZE, TX_SIZE>::write(const uint8_t *buffer, size_t size)
+{
+    size_t left = size;
+    bool full = false;
+
+    if (size == 0) {
+        return 0;
+    }
+    _written = true;
+    _wait_tx_chain();
+
+    // Same shortcut as write(uint8_t) for the first byte.
+    if ( _tx.empty() && ((*_hwserial_module).STATUS & USART_DREIF_bm) ) {
+        (*_hwserial_module).TXDATAL = *buffer++;
+        (*_hwserial_module).STATUS = USART_TXCIF_bm;
+        (*_hwserial_module).CTRLA &= (~USART_DREIE_bm);
+        if (--left == 0) {
+            _tx_stats(1, 0);
+            return size;
+        }
+    }
+
+    _elevate_dre_interrupt();
+
+    // Copy the largest contiguous free span at once: at most two copies
+    // per trip around the ring (up to the end of the buffer, then from
+    // the start), instead of one virtual call per byte.
+    while (left != 0) {
+        size_t span = _tx.write(buffer, left);
+
+        if (span == 0) {
+            //If the output buffer is full, there's nothing for it other than to
+            //wait for the interrupt handler to empty it a bit (or emulate interrupts)
+            full = true;
+            _poll_tx_data_empty();
+            continue;
+        }
+        buffer += span;
+        left -= span;
+
+        // Enable data "register empty interrupt". Once per copy: the ISR
+        // disables it if it drains the buffer before the next bytes are in.
+        (*_hwserial_module).CTRLA |= USART_DREIE_bm;
+    }
+
+    // The buffer peaks after the last span, unless it filled up on the way.
+    _tx_stats(size, full ? TX_SIZE - 1 : _tx.available());
+    return size;
 }
 
 #endif // whole file
@@ -81,6 +81,9 @@ const DeviceDescriptor USB_DeviceDescriptorIAD =
 volatile uint8_t _usbConfiguration = 0;
 volatile uint8_t _usbCurrentStatus = 0; // meaning of bits see usb_20.pdf, Figure 9-4. Information Returned by a GetStatus() Request to a Device
 volatile uint8_t _usbSuspendState = 0; // copy of UDINT to check SUSPI and WAKEUPI bits
+// Endpoints (bit n for endpoint n) whose last packet sent by USB_SendBank was
+// full: USB_Flush ends the transfer with a zero length packet.
+static volatile uint8_t _usbTxZlp = 0;
 
 static inline void WaitIN(void)
 {
@@ -221,22 +224,31 @@ uint8_t USB_Available(uint8_t ep)
 
 //	Non Blocking receive
 //	Return number of bytes read
+//	Endpoints are double banked: once a bank is emptied and released the
+//	host can fill it again, while the other bank (if already received)
+//	is read in the same call.
 int USB_Recv(uint8_t ep, void* d, int len)
 {
 	if (!_usbConfiguration || len < 0)
 		return -1;
 	
 	LockEP lock(ep);
-	uint8_t n = FifoByteCount();
-	len = min(n,len);
-	n = len;
 	uint8_t* dst = (uint8_t*)d;
-	while (n--)
-		*dst++ = Recv8();
-	if (len && !FifoByteCount())	// release empty buffer
-		ReleaseRX();
+	int done = 0;
+	while (done < len)
+	{
+		uint8_t n = FifoByteCount();
+		if (!n)
+			break;
+		if (n > len - done)
+			n = len - done;
+		Recv(dst + done, n);
+		done += n;
+		if (!FifoByteCount())	// release empty buffer
+			ReleaseRX();
+	}
 	
-	return len;
+	return done;
 }
 
 //	Recv 1 byte if ready
@@ -328,6 +340,38 @@ int USB_Send(uint8_t ep, const void* d, int len)
 	return r;
 }
 
+//	Non blocking send to the current bank of an endpoint, the bank is
+//	sent once full. Return the number of bytes copied, 0 if no bank is free.
+//	Partial banks go out with USB_Flush (i.e. at the next start of frame).
+uint8_t USB_SendBank(uint8_t ep, const void* d, uint8_t len)
+{
+	if (!_usbConfiguration)
+		return 0;
+
+	LockEP lock(ep);
+	if (!ReadWriteAllowed())
+		return 0;
+
+	const uint8_t* data = (const uint8_t*)d;
+	uint8_t n = USB_EP_SIZE - FifoByteCount();
+	if (n > len)
+		n = len;
+	for (uint8_t i = n; i; i--)
+		Send8(*data++);
+
+	uint8_t mask = 1 << (ep & 7);
+	_usbTxZlp &= ~mask;
+	if (!ReadWriteAllowed()) {	// bank is full: send it
+		ReleaseTX();
+		_usbTxZlp |= mask;
+	}
+	if (n) {
+		TXLED1;					// light the TX LED
+		TxLEDPulse = TX_RX_LED_PULSE_MS;
+	}
+	return n;
+}
+
 uint16_t _initEndpoints[USB_ENDPOINTS] =
 {
 	0,                      // Control Endpoint
@@ -654,9 +698,16 @@ ISR(USB_COM_vect)
 
 void USB_Flush(uint8_t ep)
 {
-	SetEP(ep);
-	if (FifoByteCount())
+	LockEP lock(ep);
+	uint8_t mask = 1 << (ep & 7);
+
+	if (FifoByteCount()) {
 		ReleaseTX();
+		_usbTxZlp &= ~mask;
+	} else if ((_usbTxZlp & mask) && ReadWriteAllowed()) {
+		ReleaseTX();			// zero length packet: end of transfer
+		_usbTxZlp &= ~mask;
+	}
 }
 
 static inline void USB_ClockDisable()
@@ -762,7 +813,8 @@ ISR(USB_GEN_vect)
 	//	Start of Frame - happens every millisecond so we use it for TX and RX LED one-shot timing, too
 	if (udint & (1<<SOFI))
 	{
-		USB_Flush(CDC_TX);				// Send a tx frame if found
+		CDC_StartOfFrame();				// Move buffered CDC data to the endpoint...
+		USB_Flush(CDC_TX);				// ...and send a tx frame if found
 		
 		// check whether the one-shot period has elapsed.  if so, turn off the LED
 		if (TxLEDPulse && !(--TxLEDPulse))
@@ -32,6 +32,14 @@
 
 #include "wiring_private.h"
 
+// ISR profiling (see hal/interrupts/isr_profile.h) is opt-in: targets that
+// don't enable it need not export the header.
+#ifdef ISR_PROFILE
+#include "isr_profile.h"
+#else
+#define ISR_PROFILE_SCOPE(id)
+#endif
+
 static volatile voidFuncPtrParam intFunc[EXTERNAL_NUM_INTERRUPTS];
 static void* args[EXTERNAL_NUM_INTERRUPTS];
 
@@ -148,6 +156,7 @@ static void port_interrupt_handler(uint8_t port) {
 
 #define IMPLEMENT_ISR(vect, port) \
 ISR(vect) { \
+  ISR_PROFILE_SCOPE((isr_profile_vector_t)(isr_profile_port_a + (port))); \
   port_interrupt_handler(port);\
 } \
 
@@ -57,6 +57,7 @@ int USB_RecvControlLong(void* d, int len);
 uint8_t	USB_Available(uint8_t ep);
 uint8_t USB_SendSpace(uint8_t ep);
 int USB_Send(uint8_t ep, const void* data, int len);	// blocking
+uint8_t USB_SendBank(uint8_t ep, const void* data, uint8_t len);	// non-blocking
 int USB_Recv(uint8_t ep, void* data, int len);		// non-blocking
 int USB_Recv(uint8_t ep);							// non-blocking
 void USB_Flush(uint8_t ep);
@@ -20,9 +20,11 @@
 
 #include <Arduino.h>
 #include "timer.h"
+#include "pit.h"
 #include "sleep.h"
 #include "watchdog.h"
 #include "reset.h"
+#include "isr_profile.h"
 #include <avr/io.h>
 
 // Declared weak in Arduino.h to allow user redefinitions.
@@ -38,6 +40,12 @@ void timer_clbk(void)
     Serial.println("Interrupt");
 }
 
+void watchdog_warning(watchdog_checkpoint_t culprit)
+{
+    /* Watchdog is about to bite: keep a record for next boot. */
+    reset_capture(culprit, 0);
+}
+
 int main(void)
 {
     reset_cause_t hw;
@@ -45,9 +53,11 @@ int main(void)
 
     reset_init();
     timer_init();
+    pit_init();
     init();
 
     initVariant();
+    isr_profile_init();
 
 #if defined(USBCON)
     USBDevice.attach();
@@ -59,13 +69,18 @@ int main(void)
     hw = reset_read_last(&sw);
     delay(10000);
     watchdog_init();
+    watchdog_set_early_warning(watchdog_warning);
+    sleep_init();
     if((hw != reset_power_on) && (hw != reset_external))
     {
         /* Abnormal reset: spit it out. */
         Serial.print("Reset: ");
         Serial.print(hw);
         Serial.print(" Software code: ");
-        Serial.println(sw);
+        Serial.print(sw);
+        Serial.print(" Watchdog checkpoint: ");
+        Serial.println(watchdog_read_culprit());
+        reset_dump_print(Serial);
     }
 
     for (;;) 
@@ -76,6 +91,11 @@ int main(void)
         delay(1000);
         if (serialEventRun) serialEventRun();
         watchdog_kick();
+        if (Serial.read() == 'p')
+        {
+            /* ISR profile on demand: printing it takes a while. */
+            isr_profile_print(Serial);
+        }
     }
 
     return 0;
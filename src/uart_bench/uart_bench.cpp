@@ -0,0 +1,138 @@
+/*!\file uart_bench.cpp
+** \author
+** \copyright
+** \brief UART transmit throughput benchmark.
+** \details Send the same payload through UartClass::write(buf, size)
+**          (bulk), through the generic Print::write loop (one
+**          virtual write(uint8_t) per byte) and as a descriptor chain
+**          (UartClass::writeChain, no copy) at several baud rates.
+**          For each run report the line throughput (bytes/sec, until
+**          the last byte left the shift register) and the cpu time
+**          spent inside the write call, with the baud rate actually
+**          programmed (see UartClass::baudActual). Results are printed
+**          at the end, at 115200 baud, i.e.:
+**
+**          baud=1000000 (1000000, 0 bp) bulk: 99108 B/s, cpu 9712 us
+**/
+/****************************************************************/
+
+#include <Arduino.h>
+/****************************************************************/
+
+#define BENCH_CHUNK 256
+#define BENCH_CHUNKS 16
+#define BENCH_BYTES ((uint32_t)BENCH_CHUNK * BENCH_CHUNKS)
+
+enum bench_mode
+{
+    bench_per_byte,
+    bench_bulk,
+    bench_chain,
+    BENCH_MODES
+};
+
+struct bench_result
+{
+    uint32_t baud;
+    uint32_t actual;
+    int16_t error_bp;
+    enum bench_mode mode;
+    uint32_t bytes_per_sec;
+    uint32_t cpu_us;
+};
+
+static const uint32_t bauds[] = {115200, 1000000, 2000000};
+static struct bench_result results[BENCH_MODES * sizeof(bauds) / sizeof(bauds[0])];
+static uint8_t chunk[BENCH_CHUNK];
+static UartTxDescriptor chain[BENCH_CHUNKS];
+static const char *const mode_names[BENCH_MODES] = {"per-byte", "bulk", "chain"};
+
+static void bench_run(struct bench_result *res, uint32_t baud, enum bench_mode mode)
+{
+    uint32_t start, cpu = 0, total;
+    uint8_t i;
+
+    Serial.begin(baud);
+    start = micros();
+    if(mode == bench_chain)
+    {
+        for(i = 0; i < BENCH_CHUNKS; i++)
+        {
+            chain[i].data = chunk;
+            chain[i].length = BENCH_CHUNK;
+            chain[i].progmem = false;
+            chain[i].complete = NULL;
+            chain[i].next = (i + 1 < BENCH_CHUNKS) ? &chain[i + 1] : NULL;
+        }
+        Serial.writeChain(chain);
+        cpu = micros() - start;
+    }
+    for(i = 0; (mode != bench_chain) && (i < BENCH_CHUNKS); i++)
+    {
+        uint32_t t = micros();
+
+        if(mode == bench_bulk)
+        {
+            Serial.write(chunk, BENCH_CHUNK);
+        }
+        else
+        {
+            /* Bypass the override: what every caller got before. */
+            Serial.Print::write(chunk, BENCH_CHUNK);
+        }
+        cpu += micros() - t;
+    }
+    Serial.flush();
+    total = micros() - start;
+    res->actual = Serial.baudActual();
+    res->error_bp = Serial.baudError();
+    Serial.end();
+
+    res->baud = baud;
+    res->mode = mode;
+    res->bytes_per_sec = (BENCH_BYTES * 1000000UL) / total;
+    res->cpu_us = cpu;
+}
+
+void setup()
+{
+    uint16_t j;
+    uint8_t i, m;
+
+    /* BENCH_CHUNK doesn't fit an 8 bit counter. */
+    for(j = 0; j < BENCH_CHUNK; j++)
+    {
+        chunk[j] = ' ' + (j % 64);
+    }
+    for(i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++)
+    {
+        for(m = 0; m < BENCH_MODES; m++)
+        {
+            bench_run(&results[BENCH_MODES * i + m], bauds[i], (enum bench_mode)m);
+        }
+    }
+
+    Serial.begin(115200);
+    Serial.println();
+    for(i = 0; i < sizeof(results) / sizeof(results[0]); i++)
+    {
+        Serial.print(F("baud="));
+        Serial.print(results[i].baud);
+        Serial.print(F(" ("));
+        Serial.print(results[i].actual);
+        Serial.print(F(", "));
+        Serial.print(results[i].error_bp);
+        Serial.print(F(" bp) "));
+        Serial.print(mode_names[results[i].mode]);
+        Serial.print(F(": "));
+        Serial.print(results[i].bytes_per_sec);
+        Serial.print(F(" B/s, cpu "));
+        Serial.print(results[i].cpu_us);
+        Serial.println(F(" us"));
+    }
+}
+
+void loop()
+{
+}
+/****************************************************************/